@@ -0,0 +1,155 @@
+//========================================================//
+//  checkpoint.cpp                                        //
+//  Source file for predictor checkpoints                 //
+//                                                        //
+//  A header and the flat state image of a predictor,     //
+//  written with stdio and read back through mmap         //
+//========================================================//
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "checkpoint.h"
+
+static const char checkpointMagic[4] = {'B', 'P', 'C', 'K'};
+
+// Offset of the state image in a checkpoint file
+#define CHECKPOINT_STATE ((sizeof(checkpoint_header) + CHECKPOINT_ALIGN - 1) & ~(size_t)(CHECKPOINT_ALIGN - 1))
+
+// Returns the size of the state image of 'bp'
+//
+static size_t state_size(Predictor *bp)
+{
+  state_image image = {NULL, 0, 0};
+  bp->checkpoint(image);
+  return image.size;
+}
+
+void follow_records(checkpoint_follow *f, uint64_t at, uint64_t position, const branch_record *recs, size_t n)
+{
+  uint64_t first = std::max(at, position);
+  uint64_t last = std::min(at + CHECKPOINT_FOLLOW, position + n);
+  if (f->count == 0)
+  {
+    f->hash = 0xcbf29ce484222325ull;
+  }
+  // FNV-1a over the fields of the records
+  for (uint64_t i = first; i < last; i++)
+  {
+    const branch_record &r = recs[i - position];
+    uint64_t fields[3] = {r.pc, r.target, r.flags};
+    for (int k = 0; k < 3; k++)
+    {
+      f->hash = (f->hash ^ fields[k]) * 0x100000001b3ull;
+    }
+    f->count++;
+  }
+}
+
+void take_checkpoint(std::vector<uint8_t> &file, Predictor *bp, const predictor_config *cfg, uint64_t position,
+                     uint64_t branches, uint64_t mispredictions)
+{
+  file.assign(CHECKPOINT_STATE + state_size(bp), 0);
+  checkpoint_header *header = (checkpoint_header *)file.data();
+  memcpy(header->magic, checkpointMagic, sizeof(header->magic));
+  header->version = CHECKPOINT_VERSION;
+  header->position = position;
+  header->branches = branches;
+  header->mispredictions = mispredictions;
+  header->state_bytes = file.size() - CHECKPOINT_STATE;
+  header->config = *cfg;
+  state_image image = {file.data() + CHECKPOINT_STATE, 0, 0};
+  bp->checkpoint(image);
+}
+
+int write_checkpoint(const char *path, std::vector<uint8_t> &file, const checkpoint_follow *f)
+{
+  checkpoint_header *header = (checkpoint_header *)file.data();
+  header->follow = f->count;
+  header->follow_hash = f->hash;
+
+  std::string temp = std::string(path) + ".tmp";
+  FILE *stream = fopen(temp.c_str(), "wb");
+  if (stream == NULL)
+  {
+    perror(temp.c_str());
+    return 0;
+  }
+  int ok = fwrite(file.data(), 1, file.size(), stream) == file.size();
+  ok = (fclose(stream) == 0) && ok;
+  if (!ok || rename(temp.c_str(), path) != 0)
+  {
+    perror(path);
+    remove(temp.c_str());
+    return 0;
+  }
+  return 1;
+}
+
+Predictor *load_checkpoint(const char *path, checkpoint_header *header)
+{
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    perror(path);
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return NULL;
+  }
+  size_t size = st.st_size;
+  if (size < CHECKPOINT_STATE)
+  {
+    fprintf(stderr, "%s: not a checkpoint\n", path);
+    close(fd);
+    return NULL;
+  }
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    perror("mmap");
+    return NULL;
+  }
+
+  Predictor *bp = NULL;
+  memcpy(header, map, sizeof(*header));
+  if (memcmp(header->magic, checkpointMagic, sizeof(header->magic)) != 0)
+  {
+    fprintf(stderr, "%s: not a checkpoint\n", path);
+  }
+  else if (header->version != CHECKPOINT_VERSION)
+  {
+    fprintf(stderr, "%s: checkpoint version %u, this predictor reads version %d\n", path, header->version,
+            CHECKPOINT_VERSION);
+  }
+  else if (!valid_config(&header->config))
+  {
+    fprintf(stderr, "%s: checkpoint of a predictor configuration out of range\n", path);
+  }
+  else
+  {
+    // the predictor sizes its own image, which has to be the one saved
+    bp = create_predictor(&header->config);
+    if (header->state_bytes != state_size(bp) || size < CHECKPOINT_STATE + header->state_bytes)
+    {
+      fprintf(stderr, "%s: checkpoint state does not fit its predictor\n", path);
+      delete bp;
+      bp = NULL;
+    }
+    else
+    {
+      state_image image = {(uint8_t *)map + CHECKPOINT_STATE, 0, 1};
+      bp->checkpoint(image);
+    }
+  }
+  munmap(map, size);
+  return bp;
+}
@@ -0,0 +1,83 @@
+//========================================================//
+//  checkpoint.h                                          //
+//  Header file for predictor checkpoints                 //
+//                                                        //
+//  Saves the state of a predictor at a branch of the     //
+//  trace, so a later run can go on from there            //
+//========================================================//
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdint.h>
+#include <vector>
+#include "predictor.h"
+#include "trace.h"
+
+// Version of the checkpoint format, bumped whenever the state of a
+// predictor or the header changes
+#define CHECKPOINT_VERSION 2
+
+// Records after a checkpoint whose hash ties it to its trace
+#define CHECKPOINT_FOLLOW 1024
+
+// Alignment of the state that follows the header
+#define CHECKPOINT_ALIGN 64
+
+// Header of a checkpoint file. The state_image of the predictor
+// follows, from the first CHECKPOINT_ALIGN boundary after the header,
+// so a mapped file is loaded with a copy per field
+struct checkpoint_header
+{
+  char magic[4];            // "BPCK"
+  uint32_t version;         // CHECKPOINT_VERSION
+  uint64_t position;        // branches of the trace before the checkpoint
+  uint64_t branches;        // conditional branches counted up to it
+  uint64_t mispredictions;
+  uint64_t state_bytes;     // size of the state image
+  uint64_t follow;          // records after 'position' in follow_hash,
+                            // CHECKPOINT_FOLLOW unless the trace ends
+  uint64_t follow_hash;
+  predictor_config config;  // the predictor the state belongs to
+};
+
+// The hash of the records after a checkpoint, built up as the batches
+// of the trace go past. Starts zeroed
+struct checkpoint_follow
+{
+  uint64_t count;
+  uint64_t hash;
+};
+
+// Hashes into 'f' the records of a batch that fall among the
+// CHECKPOINT_FOLLOW after branch 'at'. 'position' is the branch of the
+// first record of the batch
+//
+void follow_records(checkpoint_follow *f, uint64_t at, uint64_t position, const branch_record *recs, size_t n);
+
+// Takes a checkpoint of 'bp', created from 'cfg', into 'file': the
+// position in the trace, the statistics so far and the state of the
+// predictor. It is written once the records after it are hashed
+//
+void take_checkpoint(std::vector<uint8_t> &file, Predictor *bp, const predictor_config *cfg, uint64_t position,
+                     uint64_t branches, uint64_t mispredictions);
+
+// Writes the checkpoint in 'file' to 'path', with 'f' the records
+// after it. The file is written beside 'path' and renamed over it, so
+// an interrupted save leaves any older checkpoint intact
+//
+// Returns False if the file cannot be written
+//
+int write_checkpoint(const char *path, std::vector<uint8_t> &file, const checkpoint_follow *f);
+
+// Maps the checkpoint at 'path' and creates the predictor it holds.
+// 'header' receives its header, whose follow_hash the caller checks
+// against the trace
+//
+// Returns the predictor, NULL if the file cannot be read, is of
+// another version, holds a configuration out of range or does not
+// match its predictor
+//
+Predictor *load_checkpoint(const char *path, checkpoint_header *header);
+
+#endif
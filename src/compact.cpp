@@ -0,0 +1,807 @@
+//========================================================//
+//  compact.cpp                                           //
+//  Source file for the compact columnar trace format     //
+//                                                        //
+//  Models each record against the last time its PC was  //
+//  seen and compresses the residues column by column     //
+//========================================================//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <zlib.h>
+#include <bzlib.h>
+#include "compact.h"
+
+// Handy Global for use in output routines
+const char *codecName[4] = {"raw", "deflate", "bzip2", "best"};
+
+int parse_codec(const char *name)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    if (!strcmp(name, codecName[i]))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+//------------------------------------//
+//           Column Coding            //
+//------------------------------------//
+
+static inline uint32_t zigzag(uint32_t delta)
+{
+  return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t z)
+{
+  return (z >> 1) ^ (0 - (z & 1));
+}
+
+static inline void put_varint(std::vector<uint8_t> &out, uint32_t v)
+{
+  while (v >= 0x80)
+  {
+    out.push_back((uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back((uint8_t)v);
+}
+
+// Returns False if the varint runs past 'end'
+//
+static inline int get_varint(const uint8_t **p, const uint8_t *end, uint32_t *v)
+{
+  uint32_t x = 0;
+  for (int shift = 0; shift < 35 && *p < end; shift += 7)
+  {
+    uint8_t b = *(*p)++;
+    x |= (uint32_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+    {
+      *v = x;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static inline int get_bit(const uint8_t *bits, size_t i)
+{
+  return (bits[i >> 3] >> (i & 7)) & 1;
+}
+
+// Compresses 'raw' with 'codec' into 'out'
+//
+// Returns False if the codec fails (or does not shrink the column)
+//
+static int compress_column(int codec, const std::vector<uint8_t> &raw, std::vector<uint8_t> &out)
+{
+  switch (codec)
+  {
+  case CODEC_DEFLATE:
+    {
+      uLongf len = compressBound(raw.size());
+      out.resize(len);
+      if (compress2(out.data(), &len, raw.data(), raw.size(), 9) != Z_OK)
+      {
+        return 0;
+      }
+      out.resize(len);
+      break;
+    }
+  case CODEC_BZ2:
+    {
+      unsigned int len = raw.size() + raw.size() / 100 + 600;
+      out.resize(len);
+      if (BZ2_bzBuffToBuffCompress((char *)out.data(), &len, (char *)raw.data(), raw.size(), 9, 0, 0) != BZ_OK)
+      {
+        return 0;
+      }
+      out.resize(len);
+      break;
+    }
+  default:
+    return 0;
+  }
+  return out.size() < raw.size();
+}
+
+// Decompresses a stored column into 'raw', which holds its raw size
+//
+// Returns False if the column is corrupt
+//
+static int decompress_column(const compact_column *col, const char *data, std::vector<uint8_t> &raw)
+{
+  raw.resize(col->raw_size);
+  switch (col->codec)
+  {
+  case CODEC_RAW:
+    if (col->stored_size != col->raw_size)
+    {
+      return 0;
+    }
+    memcpy(raw.data(), data, col->raw_size);
+    return 1;
+  case CODEC_DEFLATE:
+    {
+      uLongf len = col->raw_size;
+      return uncompress(raw.data(), &len, (const Bytef *)data, col->stored_size) == Z_OK &&
+             len == col->raw_size;
+    }
+  case CODEC_BZ2:
+    {
+      unsigned int len = col->raw_size;
+      return BZ2_bzBuffToBuffDecompress((char *)raw.data(), &len, (char *)data, col->stored_size, 0, 0) == BZ_OK &&
+             len == col->raw_size;
+    }
+  default:
+    return 0;
+  }
+}
+
+//------------------------------------//
+//            Compact Reader          //
+//------------------------------------//
+
+// Decodes the dictionary column
+//
+// Returns False if it is corrupt
+//
+static int decode_dictionary(const compact_dict_header *hdr, const char *data, std::vector<uint32_t> &dict)
+{
+  std::vector<uint8_t> raw;
+  if (hdr->column.raw_size > 5 * (uint64_t)hdr->entries || !decompress_column(&hdr->column, data, raw))
+  {
+    return 0;
+  }
+
+  const uint8_t *p = raw.data();
+  const uint8_t *end = p + raw.size();
+  uint32_t pc = 0;
+  dict.resize(hdr->entries);
+  for (uint32_t i = 0; i < hdr->entries; i++)
+  {
+    uint32_t z;
+    if (!get_varint(&p, end, &z))
+    {
+      return 0;
+    }
+    pc += unzigzag(z);
+    dict[i] = pc;
+  }
+  return 1;
+}
+
+int CompactBlockDecoder::load_column(int c, const compact_column *col, const char *data, size_t n)
+{
+  // a varint is at most 5 bytes, a bit column exactly one bit a record
+  if (c <= COL_TARGET ? col->raw_size > 5 * (uint64_t)n : col->raw_size != (n + 7) / 8)
+  {
+    return 0;
+  }
+  return decompress_column(col, data, columns[c]);
+}
+
+int CompactBlockDecoder::decode(size_t n, const std::vector<uint32_t> &dict, branch_record *out)
+{
+  if (n == 0 || dict.empty())
+  {
+    return 0;
+  }
+
+  // restart the models
+  succ.assign(dict.size(), 0);
+  last_target.assign(dict.begin(), dict.end());
+  last_flags.assign(dict.size(), 0);
+
+  const uint8_t *pcs = columns[COL_PC].data();
+  const uint8_t *pcs_end = pcs + columns[COL_PC].size();
+  const uint8_t *targets = columns[COL_TARGET].data();
+  const uint8_t *targets_end = targets + columns[COL_TARGET].size();
+  uint32_t prev = 0;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    uint32_t z, t;
+    if (!get_varint(&pcs, pcs_end, &z) || !get_varint(&targets, targets_end, &t))
+    {
+      return 0;
+    }
+    uint32_t idx = succ[prev] + unzigzag(z);
+    if (idx >= dict.size())
+    {
+      return 0;
+    }
+    succ[prev] = idx;
+    prev = idx;
+
+    last_target[idx] += unzigzag(t);
+    uint8_t flags = get_bit(columns[COL_OUTCOME].data(), i) |
+                    get_bit(columns[COL_CONDITION].data(), i) << 1 |
+                    get_bit(columns[COL_CALL].data(), i) << 2 |
+                    get_bit(columns[COL_RET].data(), i) << 3 |
+                    get_bit(columns[COL_DIRECT].data(), i) << 4;
+    last_flags[idx] ^= flags;
+
+    out[i].pc = dict[idx];
+    out[i].target = last_target[idx];
+    out[i].flags = last_flags[idx];
+  }
+  return 1;
+}
+
+//##################
+// sequential reader
+//##################
+
+CompactTraceReader::CompactTraceReader(ByteSource *src, const char *data, size_t len)
+  : TraceDecoder(src, data, len), pos(0)
+{
+}
+
+const char *CompactTraceReader::take(size_t n)
+{
+  if (carry.empty() && (size_t)(end - cur) >= n)
+  {
+    const char *p = cur;
+    cur += n;
+    return p;
+  }
+
+  // the bytes span blocks of the source. On failure the partial bytes
+  // are left in 'carry'
+  while (carry.size() + (end - cur) < n)
+  {
+    if (!refill())
+    {
+      return NULL;
+    }
+  }
+  size_t need = n - carry.size();
+  carry.insert(carry.end(), cur, cur + need);
+  cur += need;
+  stash.swap(carry);
+  carry.clear();
+  return stash.data();
+}
+
+int CompactTraceReader::load_dictionary()
+{
+  compact_dict_header hdr;
+  const char *p = take(sizeof(hdr));
+  if (p == NULL)
+  {
+    fprintf(stderr, "Compact trace has no dictionary\n");
+    return 0;
+  }
+  memcpy(&hdr, p, sizeof(hdr));
+
+  if ((p = take(hdr.column.stored_size)) == NULL || !decode_dictionary(&hdr, p, dict))
+  {
+    fprintf(stderr, "Corrupt compact trace dictionary\n");
+    return 0;
+  }
+  return 1;
+}
+
+int CompactTraceReader::decode_block()
+{
+  compact_block_header hdr;
+  const char *p = take(sizeof(hdr));
+  if (p == NULL)
+  {
+    if (!carry.empty())
+    {
+      fprintf(stderr, "Warning: truncated block at the end of the compact trace\n");
+      carry.clear();
+    }
+    return 0;
+  }
+  memcpy(&hdr, p, sizeof(hdr));
+
+  // the empty block in front of the index
+  if (hdr.records == 0)
+  {
+    cur = end;
+    carry.clear();
+    return 0;
+  }
+
+  for (int c = 0; c < COMPACT_COLUMNS; c++)
+  {
+    if ((p = take(hdr.columns[c].stored_size)) == NULL)
+    {
+      fprintf(stderr, "Warning: truncated block at the end of the compact trace\n");
+      carry.clear();
+      return 0;
+    }
+    if (!decoder.load_column(c, &hdr.columns[c], p, hdr.records))
+    {
+      fprintf(stderr, "Corrupt block in the compact trace\n");
+      return 0;
+    }
+  }
+
+  block.resize(hdr.records);
+  pos = 0;
+  if (!decoder.decode(hdr.records, dict, block.data()))
+  {
+    fprintf(stderr, "Corrupt block in the compact trace\n");
+    block.clear();
+    return 0;
+  }
+  return 1;
+}
+
+size_t CompactTraceReader::read(branch_record *recs, size_t max)
+{
+  size_t n = 0;
+  while (n < max)
+  {
+    if (pos == block.size() && !decode_block())
+    {
+      break;
+    }
+    size_t count = std::min(max - n, block.size() - pos);
+    memcpy(recs + n, block.data() + pos, count * sizeof(branch_record));
+    pos += count;
+    n += count;
+  }
+  return n;
+}
+
+size_t CompactTraceReader::next_batch(const branch_record **recs)
+{
+  // hand out the rest of the decoded block in place
+  if (pos == block.size() && !decode_block())
+  {
+    return 0;
+  }
+  size_t count = block.size() - pos;
+  *recs = block.data() + pos;
+  pos = block.size();
+  return count;
+}
+
+//##################
+// index
+//##################
+
+int CompactIndex::load(const char *base, size_t size)
+{
+  bin_trace_header hdr;
+  compact_trailer trailer;
+  if (size < BIN_HEADER_SIZE + sizeof(compact_dict_header) + sizeof(trailer))
+  {
+    return 0;
+  }
+  memcpy(&hdr, base, sizeof(hdr));
+  memcpy(&trailer, base + size - sizeof(trailer), sizeof(trailer));
+  if (memcmp(hdr.magic, COMPACT_TRACE_MAGIC, 4) || hdr.version != COMPACT_TRACE_VERSION ||
+      memcmp(trailer.magic, COMPACT_INDEX_MAGIC, 4) || trailer.version != COMPACT_TRACE_VERSION)
+  {
+    return 0;
+  }
+
+  // the index runs from its offset up to the trailer
+  uint64_t index_size = size - sizeof(trailer) - trailer.index_offset;
+  if (trailer.index_offset > size - sizeof(trailer) ||
+      index_size != trailer.entries * sizeof(compact_index_entry))
+  {
+    fprintf(stderr, "Corrupt compact trace index\n");
+    return 0;
+  }
+  entries.resize(trailer.entries);
+  memcpy(entries.data(), base + trailer.index_offset, index_size);
+
+  compact_dict_header dhdr;
+  memcpy(&dhdr, base + BIN_HEADER_SIZE, sizeof(dhdr));
+  size_t dict_offset = BIN_HEADER_SIZE + sizeof(dhdr);
+  if (dhdr.column.stored_size > trailer.index_offset - dict_offset ||
+      !decode_dictionary(&dhdr, base + dict_offset, dict))
+  {
+    fprintf(stderr, "Corrupt compact trace dictionary\n");
+    return 0;
+  }
+
+  this->base = base;
+  records = hdr.records;
+  blocks_end = trailer.index_offset;
+  return 1;
+}
+
+size_t CompactIndex::find(uint64_t record) const
+{
+  size_t lo = 0;
+  size_t hi = entries.size();
+  while (hi - lo > 1)
+  {
+    size_t mid = (lo + hi) / 2;
+    if (entries[mid].record <= record)
+    {
+      lo = mid;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+int CompactIndex::decode(size_t i, CompactBlockDecoder *decoder, std::vector<branch_record> &out) const
+{
+  compact_block_header hdr;
+  uint64_t pos = entries[i].offset;
+  if (pos > blocks_end || blocks_end - pos < sizeof(hdr))
+  {
+    return 0;
+  }
+  memcpy(&hdr, base + pos, sizeof(hdr));
+  pos += sizeof(hdr);
+
+  for (int c = 0; c < COMPACT_COLUMNS; c++)
+  {
+    if (hdr.columns[c].stored_size > blocks_end - pos ||
+        !decoder->load_column(c, &hdr.columns[c], base + pos, hdr.records))
+    {
+      return 0;
+    }
+    pos += hdr.columns[c].stored_size;
+  }
+
+  out.resize(hdr.records);
+  return decoder->decode(hdr.records, dict, out.data());
+}
+
+//##################
+// parallel reader
+//##################
+
+CompactChunkSource::CompactChunkSource(const char *base, size_t size, CompactIndex &index,
+                                       uint64_t first, uint64_t last)
+  : ParallelDecoder(base, size), index(index), first(first), last(last)
+{
+  first_block = index.find(first);
+  start(first < last ? index.find(last - 1) + 1 - first_block : 0);
+}
+
+CompactChunkSource::~CompactChunkSource()
+{
+  stop();
+}
+
+int CompactChunkSource::decode_unit(size_t i)
+{
+  size_t b = first_block + i;
+  CompactBlockDecoder decoder;
+  std::vector<branch_record> recs;
+  if (!index.decode(b, &decoder, recs))
+  {
+    return 0;
+  }
+
+  // trim the blocks at either end of the range
+  uint64_t lo = std::max(first, index.entries[b].record);
+  uint64_t hi = std::min(last, index.entries[b].record + recs.size());
+  if (lo >= hi)
+  {
+    return 1;
+  }
+  const char *p = (const char *)(recs.data() + (lo - index.entries[b].record));
+  std::vector<char> out(p, p + (hi - lo) * sizeof(branch_record));
+  return emit(i, out);
+}
+
+CompactRangeReader::CompactRangeReader(CompactChunkSource *src)
+  : TraceDecoder(src, "", 0)
+{
+}
+
+size_t CompactRangeReader::read(branch_record *recs, size_t max)
+{
+  size_t n = 0;
+  while (n < max)
+  {
+    if (cur == end && !refill())
+    {
+      break;
+    }
+    size_t count = std::min(max - n, (end - cur) / sizeof(branch_record));
+    memcpy(recs + n, cur, count * sizeof(branch_record));
+    cur += count * sizeof(branch_record);
+    n += count;
+  }
+  return n;
+}
+
+size_t CompactRangeReader::next_batch(const branch_record **recs)
+{
+  // the source hands out whole records, allocated as vectors and so
+  // aligned for branch_record
+  if (cur == end && !refill())
+  {
+    return 0;
+  }
+  size_t count = (end - cur) / sizeof(branch_record);
+  *recs = (const branch_record *)cur;
+  cur = end;
+  return count;
+}
+
+TraceReader *open_indexed_trace(const char *path, uint64_t first, uint64_t count, uint64_t *history)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    return NULL;
+  }
+
+  struct stat st;
+  char magic[4];
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < BIN_HEADER_SIZE ||
+      pread(fd, magic, sizeof(magic), 0) != sizeof(magic) || memcmp(magic, COMPACT_TRACE_MAGIC, 4))
+  {
+    close(fd);
+    return NULL;
+  }
+  const char *base = map_file(fd, st.st_size);
+  close(fd);
+  if (base == NULL)
+  {
+    return NULL;
+  }
+
+  CompactIndex index;
+  if (!index.load(base, st.st_size) || index.entries.empty())
+  {
+    munmap((void *)base, st.st_size);
+    return NULL;
+  }
+
+  // the snapshot at the start of the first block, carried forward to
+  // 'first' through the records before it
+  uint64_t last = index.records;
+  if (count > 0 && first < last && count < last - first)
+  {
+    last = first + count;
+  }
+  first = std::min(first, last);
+  size_t b = index.find(first);
+  memcpy(history, index.entries[b].history, sizeof(index.entries[b].history));
+  if (first > index.entries[b].record)
+  {
+    CompactBlockDecoder decoder;
+    std::vector<branch_record> recs;
+    if (!index.decode(b, &decoder, recs) || recs.size() < first - index.entries[b].record)
+    {
+      fprintf(stderr, "Corrupt block in the compact trace\n");
+      munmap((void *)base, st.st_size);
+      return NULL;
+    }
+    for (size_t i = 0; i < first - index.entries[b].record; i++)
+    {
+      if (recs[i].flags & TRACE_CONDITION)
+      {
+        push_history(history, recs[i].flags & TRACE_OUTCOME);
+      }
+    }
+  }
+
+  return new CompactRangeReader(new CompactChunkSource(base, st.st_size, index, first, last));
+}
+
+//------------------------------------//
+//            Compact Writer          //
+//------------------------------------//
+
+CompactTraceWriter::CompactTraceWriter(FILE *stream, int codec, size_t block)
+  : stream(stream), codec(codec), block(block), records(0), written(0), failed(0)
+{
+  spool = tmpfile();
+  if (spool == NULL)
+  {
+    perror("tmpfile");
+    exit(1);
+  }
+}
+
+CompactTraceWriter::~CompactTraceWriter()
+{
+  if (spool != NULL)
+  {
+    fclose(spool);
+  }
+}
+
+void CompactTraceWriter::write(const branch_record *recs, size_t n)
+{
+  if (fwrite(recs, sizeof(branch_record), n, spool) != n)
+  {
+    perror("tmpfile");
+    exit(1);
+  }
+  records += n;
+
+  for (size_t i = 0; i < n; i++)
+  {
+    std::pair<std::unordered_map<uint32_t, uint32_t>::iterator, bool> it =
+      seen.insert(std::make_pair(recs[i].pc, (uint32_t)pcs.size()));
+    if (it.second)
+    {
+      pcs.push_back(recs[i].pc);
+      counts.push_back(0);
+    }
+    counts[it.first->second]++;
+  }
+}
+
+void CompactTraceWriter::put(const void *data, size_t len)
+{
+  if (fwrite(data, 1, len, stream) != len)
+  {
+    failed = 1;
+  }
+  written += len;
+}
+
+void CompactTraceWriter::write_column(compact_column *col, const std::vector<uint8_t> &raw, std::vector<uint8_t> &out)
+{
+  std::vector<uint8_t> stored, other;
+  memset(col, 0, sizeof(*col));
+  col->codec = CODEC_RAW;
+  col->raw_size = raw.size();
+
+  if (codec == CODEC_BEST)
+  {
+    int have = compress_column(CODEC_DEFLATE, raw, stored);
+    if (compress_column(CODEC_BZ2, raw, other) && (!have || other.size() < stored.size()))
+    {
+      stored.swap(other);
+      col->codec = CODEC_BZ2;
+    }
+    else if (have)
+    {
+      col->codec = CODEC_DEFLATE;
+    }
+  }
+  else if (compress_column(codec, raw, stored))
+  {
+    col->codec = codec;
+  }
+
+  const std::vector<uint8_t> &data = (col->codec == CODEC_RAW) ? raw : stored;
+  col->stored_size = data.size();
+  out.insert(out.end(), data.begin(), data.end());
+}
+
+int CompactTraceWriter::close()
+{
+  // most frequent PCs get the smallest indices
+  std::vector<uint32_t> order(pcs.size());
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+    return counts[a] != counts[b] ? counts[a] > counts[b] : pcs[a] < pcs[b];
+  });
+
+  std::vector<uint32_t> dict(pcs.size());
+  std::vector<uint8_t> raw, out;
+  uint32_t last = 0;
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    dict[i] = pcs[order[i]];
+    seen[dict[i]] = i;
+    put_varint(raw, zigzag(dict[i] - last));
+    last = dict[i];
+  }
+
+  bin_trace_header hdr;
+  memcpy(hdr.magic, COMPACT_TRACE_MAGIC, 4);
+  hdr.version = COMPACT_TRACE_VERSION;
+  hdr.records = records;
+  put(&hdr, sizeof(hdr));
+
+  compact_dict_header dhdr;
+  dhdr.entries = dict.size();
+  write_column(&dhdr.column, raw, out);
+  put(&dhdr, sizeof(dhdr));
+  put(out.data(), out.size());
+
+  // encode the spooled records a block at a time, mirroring
+  // CompactBlockDecoder::decode()
+  std::vector<branch_record> recs(block);
+  std::vector<uint8_t> cols[COMPACT_COLUMNS];
+  std::vector<uint32_t> succ, last_target;
+  std::vector<uint8_t> last_flags;
+  std::vector<compact_index_entry> index;
+  compact_index_entry entry;
+  memset(&entry, 0, sizeof(entry));
+  rewind(spool);
+
+  size_t n;
+  while ((n = fread(recs.data(), sizeof(branch_record), block, spool)) > 0)
+  {
+    entry.offset = written;
+    index.push_back(entry);
+    succ.assign(dict.size(), 0);
+    last_target.assign(dict.begin(), dict.end());
+    last_flags.assign(dict.size(), 0);
+    for (int c = 0; c < COMPACT_COLUMNS; c++)
+    {
+      cols[c].clear();
+    }
+    for (int c = COL_OUTCOME; c < COMPACT_COLUMNS; c++)
+    {
+      cols[c].assign((n + 7) / 8, 0);
+    }
+
+    uint32_t prev = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+      uint32_t idx = seen[recs[i].pc];
+      put_varint(cols[COL_PC], zigzag(idx - succ[prev]));
+      succ[prev] = idx;
+      prev = idx;
+
+      put_varint(cols[COL_TARGET], zigzag(recs[i].target - last_target[idx]));
+      last_target[idx] = recs[i].target;
+
+      uint8_t flags = recs[i].flags ^ last_flags[idx];
+      last_flags[idx] = recs[i].flags;
+      for (int b = 0; b < 5; b++)
+      {
+        cols[COL_OUTCOME + b][i >> 3] |= ((flags >> b) & 1) << (i & 7);
+      }
+
+      if (recs[i].flags & TRACE_CONDITION)
+      {
+        push_history(entry.history, recs[i].flags & TRACE_OUTCOME);
+        entry.conditionals++;
+      }
+    }
+    entry.record += n;
+
+    compact_block_header bhdr;
+    bhdr.records = n;
+    out.clear();
+    for (int c = 0; c < COMPACT_COLUMNS; c++)
+    {
+      write_column(&bhdr.columns[c], cols[c], out);
+    }
+    put(&bhdr, sizeof(bhdr));
+    put(out.data(), out.size());
+  }
+
+  // an empty block ends the blocks, the index and its trailer follow
+  compact_block_header bhdr;
+  memset(&bhdr, 0, sizeof(bhdr));
+  put(&bhdr, sizeof(bhdr));
+
+  compact_trailer trailer;
+  trailer.index_offset = written;
+  trailer.entries = index.size();
+  memcpy(trailer.magic, COMPACT_INDEX_MAGIC, 4);
+  trailer.version = COMPACT_TRACE_VERSION;
+  put(index.data(), index.size() * sizeof(compact_index_entry));
+  put(&trailer, sizeof(trailer));
+
+  fclose(spool);
+  spool = NULL;
+  if (fflush(stream) != 0 || ferror(stream))
+  {
+    failed = 1;
+  }
+  return !failed;
+}
@@ -0,0 +1,280 @@
+//========================================================//
+//  compact.h                                             //
+//  Header file for the compact columnar trace format     //
+//                                                        //
+//  Stores a trace as a PC dictionary plus blocks of      //
+//  delta coded, separately compressed columns            //
+//========================================================//
+
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+#include <unordered_map>
+#include "trace.h"
+#include "decomp.h"
+
+//------------------------------------//
+//        Compact Trace Layout        //
+//------------------------------------//
+
+// A compact trace is
+//
+//   a 16 byte header, laid out like the binary trace header
+//   the PC dictionary: a compact_dict_header and its column, the PCs
+//     of the trace, most frequent first, as varint zigzag deltas
+//   blocks of up to 'block' records, each a compact_block_header and
+//     its columns in COL_* order
+//   a block header with 0 records, ending the blocks
+//   the index: a compact_index_entry for every block, then a
+//     compact_trailer ending the file
+//
+// Every block restarts the models below from the dictionary alone, so
+// it decodes on its own. Within a block a record is coded against the
+// previous record and the last time its PC was seen:
+//
+//   COL_PC      varint zigzag distance of the PC's dictionary index
+//               from the index that followed the previous PC last time
+//   COL_TARGET  varint zigzag delta from the PC's last target (its own
+//               address the first time)
+//   COL_OUTCOME .. COL_DIRECT
+//               one bit per record, the flag XOR its value the last
+//               time the PC was seen
+//
+// so a trace walking the same loops codes nearly every field as 0.
+// Blocks double as the chunks of the index, which lets a reader with
+// the whole file at hand seek to any branch and decode blocks in
+// parallel
+#define COMPACT_TRACE_MAGIC "BRTC"
+#define COMPACT_INDEX_MAGIC "BRTI"
+#define COMPACT_TRACE_VERSION 1
+#define COMPACT_BLOCK_RECORDS (1 << 20)
+
+// Columns of a block
+#define COL_PC        0
+#define COL_TARGET    1
+#define COL_OUTCOME   2
+#define COL_CONDITION 3
+#define COL_CALL      4
+#define COL_RET       5
+#define COL_DIRECT    6
+#define COMPACT_COLUMNS 7
+
+// Column codecs
+#define CODEC_RAW     0
+#define CODEC_DEFLATE 1 // zlib
+#define CODEC_BZ2     2
+#define CODEC_BEST    3 // writer only: the smaller of the two, per column
+extern const char *codecName[];
+
+// A stored column. A column that does not shrink is stored raw
+struct compact_column
+{
+  uint8_t codec;
+  uint8_t pad[3];
+  uint32_t raw_size;
+  uint32_t stored_size;
+};
+
+struct compact_dict_header
+{
+  uint32_t entries;
+  compact_column column;
+};
+
+struct compact_block_header
+{
+  uint32_t records;
+  compact_column columns[COMPACT_COLUMNS];
+};
+
+// Where a block starts, and the state of the trace there
+struct compact_index_entry
+{
+  uint64_t record;       // ordinal of the block's first record
+  uint64_t offset;       // byte offset of its header in the file
+  uint64_t conditionals; // conditional branches before it
+  uint64_t history[HISTORY_SNAPSHOT_WORDS];
+};
+
+struct compact_trailer
+{
+  uint64_t index_offset;
+  uint64_t entries;
+  char magic[4];
+  uint32_t version;
+};
+
+// Parses a --codec value
+//
+// Returns the CODEC_* constant, -1 if the name is unknown
+//
+int parse_codec(const char *name);
+
+//------------------------------------//
+//            Compact Reader          //
+//------------------------------------//
+
+// Decodes blocks, one at a time. Each decoding thread has its own
+class CompactBlockDecoder
+{
+public:
+  // Decompresses column 'c' of a block of 'n' records
+  //
+  // Returns False if it is corrupt
+  //
+  int load_column(int c, const compact_column *col, const char *data, size_t n);
+
+  // Decodes the loaded columns of a block of 'n' records into 'out'
+  //
+  // Returns False if they are corrupt
+  //
+  int decode(size_t n, const std::vector<uint32_t> &dict, branch_record *out);
+
+private:
+  std::vector<uint8_t> columns[COMPACT_COLUMNS];
+  std::vector<uint32_t> succ;
+  std::vector<uint32_t> last_target;
+  std::vector<uint8_t> last_flags;
+};
+
+// Decodes a compact trace one block at a time, front to back
+class CompactTraceReader : public TraceDecoder
+{
+public:
+  // 'data' and 'len' follow the 16 byte header
+  CompactTraceReader(ByteSource *src, const char *data, size_t len);
+
+  // Reads the PC dictionary
+  //
+  // Returns False if it is corrupt
+  //
+  int load_dictionary();
+
+  size_t read(branch_record *recs, size_t max);
+  size_t next_batch(const branch_record **recs);
+
+private:
+  // Hands out the next 'n' bytes of the input contiguously, gathering
+  // them into 'stash' when they span blocks of the source
+  //
+  // Returns NULL at the end of the input
+  //
+  const char *take(size_t n);
+
+  // Decodes the next block into 'block'
+  //
+  // Returns False at the end of the trace or on a corrupt block
+  //
+  int decode_block();
+
+  std::vector<uint32_t> dict;
+  std::vector<char> stash;
+  std::vector<branch_record> block;
+  size_t pos;
+  CompactBlockDecoder decoder;
+};
+
+// The dictionary and index of a compact trace mapped in memory
+class CompactIndex
+{
+public:
+  // Reads the dictionary and index of the trace mapped at 'base'
+  //
+  // Returns False if it is not a compact trace with an index
+  //
+  int load(const char *base, size_t size);
+
+  // Returns the block holding record 'record'
+  //
+  size_t find(uint64_t record) const;
+
+  // Decodes block 'i' into 'out'
+  //
+  // Returns False if it is corrupt
+  //
+  int decode(size_t i, CompactBlockDecoder *decoder, std::vector<branch_record> &out) const;
+
+  uint64_t records;
+  std::vector<uint32_t> dict;
+  std::vector<compact_index_entry> entries;
+
+private:
+  const char *base;
+  size_t blocks_end;
+};
+
+// Decodes the blocks of records [first, last) of an indexed compact
+// trace on the decompression threads, handing out their records in
+// order as raw branch_record structs
+class CompactChunkSource : public ParallelDecoder
+{
+public:
+  // Takes over a mapping made by map_file() and its loaded index
+  CompactChunkSource(const char *base, size_t size, CompactIndex &index, uint64_t first, uint64_t last);
+  ~CompactChunkSource();
+
+protected:
+  int decode_unit(size_t i);
+
+private:
+  CompactIndex index;
+  uint64_t first;
+  uint64_t last;
+  size_t first_block;
+};
+
+// Reads the records a CompactChunkSource decodes, in place
+class CompactRangeReader : public TraceDecoder
+{
+public:
+  CompactRangeReader(CompactChunkSource *src);
+  size_t read(branch_record *recs, size_t max);
+  size_t next_batch(const branch_record **recs);
+};
+
+// Opens records [first, first + count) of the compact trace at 'path'
+// through its index. A count of 0 runs to the end of the trace.
+// 'history' receives the history snapshot at 'first'
+//
+// Returns NULL if 'path' is not a compact trace with an index
+//
+TraceReader *open_indexed_trace(const char *path, uint64_t first, uint64_t count, uint64_t *history);
+
+//------------------------------------//
+//            Compact Writer          //
+//------------------------------------//
+
+// Writes compact traces. The dictionary goes first but depends on the
+// whole trace, so records are spooled to a temporary file and encoded
+// by close()
+class CompactTraceWriter
+{
+public:
+  CompactTraceWriter(FILE *stream, int codec = CODEC_BEST, size_t block = COMPACT_BLOCK_RECORDS);
+  ~CompactTraceWriter();
+  void write(const branch_record *recs, size_t n);
+
+  // Returns 0 if any write to the stream failed, 1 otherwise
+  int close();
+
+private:
+  void write_column(compact_column *col, const std::vector<uint8_t> &raw, std::vector<uint8_t> &out);
+  void put(const void *data, size_t len);
+
+  FILE *stream;
+  FILE *spool;
+  int codec;
+  size_t block;
+  uint64_t records;
+  uint64_t written; // bytes written to 'stream'
+  int failed;
+  std::vector<uint32_t> pcs;    // distinct PCs in order of appearance
+  std::vector<uint64_t> counts; // and how often each one occurs
+  std::unordered_map<uint32_t, uint32_t> seen; // PC -> slot in 'pcs'
+};
+
+#endif
@@ -0,0 +1,100 @@
+//========================================================//
+//  counters.h                                            //
+//  Header file for saturating counter tables             //
+//                                                        //
+//  Tables of n-bit saturating counters packed densely    //
+//  into 64-bit words, shared by the predictors           //
+//========================================================//
+
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <algorithm>
+
+// Alignment of a counter table
+#define COUNTER_LINE 64
+
+// A table of BITS-bit saturating counters, 64 / BITS of them to a
+// 64-bit word, so a table of 2-bit counters takes a quarter of the
+// bytes it would with one counter per byte. Unsigned counters count
+// from 0 to 2^BITS - 1, signed ones from -2^(BITS-1) to 2^(BITS-1) - 1
+// and are stored offset by 2^(BITS-1). Updates are branchless
+template <int BITS, bool SIGNED = false>
+class counter_table
+{
+public:
+  static const int per_word = 64 / BITS;
+  static const uint64_t mask = (1ull << BITS) - 1;
+  static const int min = SIGNED ? -(1 << (BITS - 1)) : 0;
+  static const int max = min + (int)mask;
+
+  counter_table() : words(NULL), nwords(0) {}
+  ~counter_table() { free(words); }
+  counter_table(const counter_table &) = delete;
+  counter_table &operator=(const counter_table &) = delete;
+
+  // Allocates 'entries' counters, each set to 'value'
+  void init(size_t entries, int value)
+  {
+    free(words);
+    nwords = (entries + per_word - 1) / per_word;
+    size_t size = (nwords * sizeof(uint64_t) + COUNTER_LINE - 1) / COUNTER_LINE * COUNTER_LINE;
+    words = (uint64_t *)aligned_alloc(COUNTER_LINE, size);
+    fill(value);
+  }
+
+  // Sets every counter to 'value', a word at a time
+  void fill(int value)
+  {
+    uint64_t pattern = 0;
+    for (int k = 0; k < per_word; k++)
+    {
+      pattern |= (uint64_t)(value - min) << (k * BITS);
+    }
+    std::fill(words, words + nwords, pattern);
+  }
+
+  int get(size_t i) const
+  {
+    return (int)((words[i / per_word] >> shift(i)) & mask) + min;
+  }
+
+  void set(size_t i, int value)
+  {
+    uint64_t &word = words[i / per_word];
+    word = (word & ~(mask << shift(i))) | ((uint64_t)(value - min) << shift(i));
+  }
+
+  // Moves counter 'i' one step up when 'up' is set, one step down
+  // otherwise, saturating at either end
+  //
+  // Returns the counter before the update
+  //
+  int update(size_t i, int up)
+  {
+    uint64_t &word = words[i / per_word];
+    uint64_t v = (word >> shift(i)) & mask;
+    uint64_t next = up ? v + (v < mask) : v - (v > 0);
+    word ^= (v ^ next) << shift(i);
+    return (int)v + min;
+  }
+
+  // Brings the word of counter 'i' into the cache ahead of its use
+  void prefetch(size_t i) const { __builtin_prefetch(words + i / per_word); }
+
+  // Bytes taken by the counters
+  size_t bytes() const { return nwords * sizeof(uint64_t); }
+
+  // The words of the counters, for checkpoints to copy
+  uint64_t *data() { return words; }
+
+private:
+  static int shift(size_t i) { return (i % per_word) * BITS; }
+
+  uint64_t *words;
+  size_t nwords;
+};
+
+#endif
@@ -0,0 +1,494 @@
+//========================================================//
+//  decomp.cpp                                            //
+//  Source file for the compressed trace sources          //
+//                                                        //
+//  Splits a compressed trace into independently          //
+//  decodable units and decodes them on worker threads    //
+//========================================================//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <bzlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "decomp.h"
+
+int decompThreads = 0;
+
+// Decoded bytes waiting to be consumed before workers ahead of the
+// reader stall
+#define DECOMP_BUFFER_BUDGET (256 << 20)
+
+// Size of the blocks decoded output is handed out in
+#define DECOMP_BLOCK_SIZE (4 << 20)
+
+//------------------------------------//
+//      Parallel Unit Decoding        //
+//------------------------------------//
+
+ParallelDecoder::ParallelDecoder(const char *base, size_t size)
+  : base(base), size(size), units(0), head(0), next_unit(0), window(0),
+    buffered(0), stopping(0)
+{
+}
+
+ParallelDecoder::~ParallelDecoder()
+{
+  stop();
+  munmap((void *)base, size);
+}
+
+void ParallelDecoder::start(size_t units)
+{
+  int threads = decompThreads;
+  if (threads <= 0)
+  {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  this->units = units;
+  window = 4 * threads;
+  for (int i = 0; i < threads; i++)
+  {
+    workers.push_back(std::thread(&ParallelDecoder::worker, this));
+  }
+}
+
+void ParallelDecoder::stop()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = 1;
+  }
+  drained.notify_all();
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    workers[i].join();
+  }
+  workers.clear();
+}
+
+void ParallelDecoder::worker()
+{
+  for (;;)
+  {
+    size_t i;
+    {
+      // claim the next unit, staying at most 'window' units ahead of
+      // the reader
+      std::unique_lock<std::mutex> guard(lock);
+      drained.wait(guard, [this] {
+        return stopping || next_unit >= units || next_unit < head + window;
+      });
+      if (stopping || next_unit >= units)
+      {
+        return;
+      }
+      i = next_unit++;
+      while (pending.size() <= i - head)
+      {
+        pending.push_back(unit_output());
+        pending.back().done = 0;
+        pending.back().failed = 0;
+      }
+    }
+
+    int ok = decode_unit(i);
+
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      pending[i - head].done = 1;
+      pending[i - head].failed = !ok;
+    }
+    ready.notify_all();
+  }
+}
+
+int ParallelDecoder::emit(size_t i, std::vector<char> &block)
+{
+  if (block.empty())
+  {
+    return 1;
+  }
+
+  {
+    // the unit at the head is always let through, so the reader can
+    // never wait on a worker that is waiting on the budget
+    std::unique_lock<std::mutex> guard(lock);
+    drained.wait(guard, [this, i] {
+      return stopping || i == head || buffered < DECOMP_BUFFER_BUDGET;
+    });
+    if (stopping)
+    {
+      return 0;
+    }
+    buffered += block.size();
+    pending[i - head].blocks.push_back(std::vector<char>());
+    pending[i - head].blocks.back().swap(block);
+  }
+  ready.notify_all();
+  return 1;
+}
+
+int ParallelDecoder::next(const char **data, size_t *len)
+{
+  std::unique_lock<std::mutex> guard(lock);
+  for (;;)
+  {
+    if (head == units)
+    {
+      return 0;
+    }
+
+    if (!pending.empty())
+    {
+      unit_output &out = pending.front();
+      if (!out.blocks.empty())
+      {
+        current.swap(out.blocks.front());
+        out.blocks.pop_front();
+        buffered -= current.size();
+        guard.unlock();
+        drained.notify_all();
+
+        *data = current.data();
+        *len = current.size();
+        return 1;
+      }
+      if (out.done)
+      {
+        if (out.failed)
+        {
+          fprintf(stderr, "Error: corrupt compressed block %zu in trace\n", head);
+          exit(1);
+        }
+        pending.pop_front();
+        head++;
+        drained.notify_all();
+        continue;
+      }
+    }
+
+    ready.wait(guard);
+  }
+}
+
+//------------------------------------//
+//              bzip2                 //
+//------------------------------------//
+
+// 48-bit magics in front of every block and at the end of a stream
+#define BZ2_BLOCK_MAGIC 0x314159265359ULL
+#define BZ2_EOS_MAGIC   0x177245385090ULL
+#define BZ2_MAGIC_MASK  0xffffffffffffULL
+
+static inline uint64_t get_bits(const uint8_t *p, uint64_t bit, int n)
+{
+  uint64_t v = 0;
+  for (int k = 0; k < n; k++)
+  {
+    v = (v << 1) | ((p[(bit + k) >> 3] >> (7 - ((bit + k) & 7))) & 1);
+  }
+  return v;
+}
+
+static inline int is_stream_header(const uint8_t *p, size_t pos, size_t size)
+{
+  return pos + 4 <= size && p[pos] == 'B' && p[pos + 1] == 'Z' &&
+         p[pos + 2] == 'h' && p[pos + 3] >= '1' && p[pos + 3] <= '9';
+}
+
+// Appends a big endian bit stream to a byte vector
+struct bit_writer
+{
+  std::vector<char> out;
+  uint64_t acc;
+  int bits;
+
+  bit_writer() : acc(0), bits(0) {}
+
+  void put(uint64_t v, int n)
+  {
+    for (int k = n - 1; k >= 0; k--)
+    {
+      acc = (acc << 1) | ((v >> k) & 1);
+      if (++bits == 8)
+      {
+        out.push_back((char)acc);
+        acc = 0;
+        bits = 0;
+      }
+    }
+  }
+
+  // copies bits [start, end) of 'p', a byte at a time where possible
+  void copy(const uint8_t *p, uint64_t start, uint64_t end)
+  {
+    int shift = start & 7;
+    uint64_t bit = start;
+    for (; bit + 8 <= end; bit += 8)
+    {
+      size_t i = bit >> 3;
+      uint8_t byte = shift ? (uint8_t)((p[i] << shift) | (p[i + 1] >> (8 - shift))) : p[i];
+      if (bits == 0)
+      {
+        out.push_back((char)byte);
+      }
+      else
+      {
+        put(byte, 8);
+      }
+    }
+    put(get_bits(p, bit, end - bit), end - bit);
+  }
+
+  void flush()
+  {
+    if (bits)
+    {
+      put(0, 8 - bits);
+    }
+  }
+};
+
+Bz2Source::Bz2Source(const char *base, size_t size)
+  : ParallelDecoder(base, size)
+{
+  const uint8_t *p = (const uint8_t *)base;
+  size_t pos = 0;
+
+  // walk the (possibly concatenated) streams, recording every block
+  while (is_stream_header(p, pos, size))
+  {
+    char level = p[pos + 3];
+    uint64_t first = (pos + 4) * 8;
+    uint64_t eos = 0;
+    int open = 0;
+    uint64_t w = 0;
+
+    for (size_t i = pos + 4; i < size && !eos; i++)
+    {
+      w = (w << 8) | p[i];
+      // a magic ending at any of the 8 bits of this byte, in bit order
+      for (int k = 7; k >= 0; k--)
+      {
+        uint64_t at = i * 8 + 7 - k - 47;
+        if (i * 8 + 7 - k < first + 47)
+        {
+          continue;
+        }
+        uint64_t m = (w >> k) & BZ2_MAGIC_MASK;
+        if (m == BZ2_BLOCK_MAGIC)
+        {
+          // a false match inside compressed data is vanishingly rare;
+          // also require a sane header: not randomised, origPtr in range
+          if (at + 48 + 32 + 25 > size * 8 ||
+              get_bits(p, at + 80, 1) != 0 ||
+              get_bits(p, at + 81, 24) >= (uint64_t)(level - '0') * 100000)
+          {
+            continue;
+          }
+          if (open)
+          {
+            blocks.back().end = at;
+          }
+          bz2_block b = {at, 0, level};
+          blocks.push_back(b);
+          open = 1;
+        }
+        else if (m == BZ2_EOS_MAGIC)
+        {
+          // the next stream, if any, starts on the following byte
+          size_t after = (at + 48 + 32 + 7) / 8;
+          if (after != size && !is_stream_header(p, after, size))
+          {
+            continue;
+          }
+          if (open)
+          {
+            blocks.back().end = at;
+          }
+          eos = at;
+          break;
+        }
+      }
+    }
+
+    if (!eos)
+    {
+      fprintf(stderr, "Error: truncated bzip2 stream in trace\n");
+      exit(1);
+    }
+    pos = (eos + 48 + 32 + 7) / 8;
+  }
+
+  start(blocks.size());
+}
+
+Bz2Source::~Bz2Source()
+{
+  stop();
+}
+
+int Bz2Source::decode_unit(size_t i)
+{
+  const uint8_t *p = (const uint8_t *)base;
+  const bz2_block &b = blocks[i];
+
+  // re-wrap the block as a stream of its own. With one block the
+  // stream CRC equals the block CRC
+  bit_writer stream;
+  stream.put('B', 8);
+  stream.put('Z', 8);
+  stream.put('h', 8);
+  stream.put(b.level, 8);
+  stream.copy(p, b.start, b.end);
+  stream.put(BZ2_EOS_MAGIC, 48);
+  stream.put(get_bits(p, b.start + 48, 32), 32);
+  stream.flush();
+
+  bz_stream bz;
+  memset(&bz, 0, sizeof(bz));
+  if (BZ2_bzDecompressInit(&bz, 0, 0) != BZ_OK)
+  {
+    return 0;
+  }
+  bz.next_in = stream.out.data();
+  bz.avail_in = stream.out.size();
+
+  int ok = 0;
+  std::vector<char> out;
+  for (;;)
+  {
+    size_t used = out.size();
+    out.resize(DECOMP_BLOCK_SIZE);
+    bz.next_out = out.data() + used;
+    bz.avail_out = out.size() - used;
+
+    int ret = BZ2_bzDecompress(&bz);
+    out.resize(out.size() - bz.avail_out);
+
+    if (ret == BZ_STREAM_END)
+    {
+      ok = emit(i, out);
+      break;
+    }
+    if (ret != BZ_OK || (bz.avail_in == 0 && bz.avail_out != 0))
+    {
+      break;
+    }
+    if (out.size() == DECOMP_BLOCK_SIZE && !emit(i, out))
+    {
+      break;
+    }
+  }
+
+  BZ2_bzDecompressEnd(&bz);
+  return ok;
+}
+
+//------------------------------------//
+//              zstd                  //
+//------------------------------------//
+
+#ifdef HAVE_ZSTD
+ZstdSource::ZstdSource(const char *base, size_t size)
+  : ParallelDecoder(base, size)
+{
+  size_t pos = 0;
+  while (pos < size)
+  {
+    size_t n = ZSTD_findFrameCompressedSize(base + pos, size - pos);
+    if (ZSTD_isError(n))
+    {
+      fprintf(stderr, "Error: corrupt zstd frame in trace: %s\n", ZSTD_getErrorName(n));
+      exit(1);
+    }
+    frames.push_back(pos);
+    pos += n;
+  }
+  frames.push_back(size);
+
+  start(frames.size() - 1);
+}
+
+ZstdSource::~ZstdSource()
+{
+  stop();
+}
+
+int ZstdSource::decode_unit(size_t i)
+{
+  ZSTD_DStream *zs = ZSTD_createDStream();
+  ZSTD_initDStream(zs);
+
+  ZSTD_inBuffer in = {base + frames[i], frames[i + 1] - frames[i], 0};
+  std::vector<char> out;
+  int ok = 0;
+  for (;;)
+  {
+    out.resize(DECOMP_BLOCK_SIZE);
+    ZSTD_outBuffer ob = {out.data(), out.size(), 0};
+    size_t ret = ZSTD_decompressStream(zs, &ob, &in);
+    if (ZSTD_isError(ret))
+    {
+      break;
+    }
+    out.resize(ob.pos);
+    if (!emit(i, out))
+    {
+      break;
+    }
+    if (ret == 0)
+    {
+      ok = 1;
+      break;
+    }
+    if (in.pos == in.size && ob.pos < ob.size)
+    {
+      // input ran out in the middle of the frame
+      break;
+    }
+  }
+
+  ZSTD_freeDStream(zs);
+  return ok;
+}
+#endif
+
+int compressed_format(const char *magic, size_t len)
+{
+  const uint8_t *p = (const uint8_t *)magic;
+
+  if (is_stream_header(p, 0, len))
+  {
+    return COMPRESS_BZ2;
+  }
+  if (len >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd)
+  {
+    return COMPRESS_ZSTD;
+  }
+  return COMPRESS_NONE;
+}
+
+ByteSource *open_compressed(const char *path, int format, const char *base, size_t size)
+{
+  switch (format)
+  {
+  case COMPRESS_BZ2:
+    return new Bz2Source(base, size);
+  case COMPRESS_ZSTD:
+#ifdef HAVE_ZSTD
+    return new ZstdSource(base, size);
+#else
+    fprintf(stderr, "%s: zstd support is not compiled in, rebuild with make ZSTD=1\n", path);
+    exit(1);
+#endif
+  default:
+    break;
+  }
+  return NULL;
+}
@@ -0,0 +1,140 @@
+//========================================================//
+//  decomp.h                                              //
+//  Header file for the compressed trace sources          //
+//                                                        //
+//  Decompresses .bz2 (and, when built with ZSTD=1, .zst) //
+//  traces on worker threads while the predictor runs     //
+//========================================================//
+
+#ifndef DECOMP_H
+#define DECOMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "trace.h"
+
+// Number of decompression threads, 0 picks one per core
+extern int decompThreads;
+
+// Decompresses the independent units of a compressed file (bzip2 blocks,
+// zstd frames) on a pool of worker threads and hands their output back
+// in order. At most 'window' units are in flight at once
+class ParallelDecoder : public ByteSource
+{
+public:
+  ParallelDecoder(const char *base, size_t size);
+  ~ParallelDecoder();
+  int next(const char **data, size_t *len);
+
+protected:
+  // Spawns the workers once the units of the file are known
+  void start(size_t units);
+
+  // Stops and joins the workers. Subclasses call this from their
+  // destructor, before the state decode_unit() relies on goes away
+  void stop();
+
+  // Decodes unit 'i' on a worker thread, passing its output to emit()
+  //
+  // Returns False if the unit is corrupt
+  //
+  virtual int decode_unit(size_t i) = 0;
+
+  // Appends a block of decoded bytes to the output of unit 'i'. Blocks
+  // the worker while too much output is waiting to be consumed
+  //
+  // Returns False if the decoder is shutting down
+  //
+  int emit(size_t i, std::vector<char> &block);
+
+  const char *base;
+  size_t size;
+
+private:
+  void worker();
+
+  struct unit_output
+  {
+    std::deque<std::vector<char> > blocks;
+    int done;
+    int failed;
+  };
+
+  std::vector<std::thread> workers;
+  std::mutex lock;
+  std::condition_variable ready;   // signalled when output is produced
+  std::condition_variable drained; // signalled when output is consumed
+  std::deque<unit_output> pending; // output of units [head, head + pending.size())
+  std::vector<char> current;       // block handed out by the last next()
+  size_t units;
+  size_t head;
+  size_t next_unit;
+  size_t window;
+  size_t buffered;
+  int stopping;
+};
+
+// Decodes every bzip2 block on its own. Blocks are found by their bit
+// aligned 48-bit magic, and each one is re-wrapped into a single block
+// stream that libbz2 can decode (and CRC check) independently
+class Bz2Source : public ParallelDecoder
+{
+public:
+  Bz2Source(const char *base, size_t size);
+  ~Bz2Source();
+
+protected:
+  int decode_unit(size_t i);
+
+private:
+  struct bz2_block
+  {
+    uint64_t start; // bit offset of the block magic
+    uint64_t end;   // bit offset of the following magic
+    char level;     // block size of the enclosing stream, '1'..'9'
+  };
+
+  std::vector<bz2_block> blocks;
+};
+
+#ifdef HAVE_ZSTD
+// Decodes every zstd frame on its own; concatenated frames (zstd -T,
+// pzstd, cat a.zst b.zst) are decoded concurrently
+class ZstdSource : public ParallelDecoder
+{
+public:
+  ZstdSource(const char *base, size_t size);
+  ~ZstdSource();
+
+protected:
+  int decode_unit(size_t i);
+
+private:
+  std::vector<size_t> frames; // byte offset of every frame, plus the end
+};
+#endif
+
+// Compression formats
+#define COMPRESS_NONE 0
+#define COMPRESS_BZ2  1
+#define COMPRESS_ZSTD 2
+
+// Sniffs the compression format from the first bytes of a file
+//
+// Returns the COMPRESS_* constant
+//
+int compressed_format(const char *magic, size_t len);
+
+// Opens a decompressing source over a mapped file of the given
+// COMPRESS_* format. The source unmaps the file when it is destroyed
+//
+// Returns NULL if the format is not compressed
+//
+ByteSource *open_compressed(const char *path, int format, const char *base, size_t size);
+
+#endif
@@ -7,26 +7,177 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <algorithm>
 #include "predictor.h"
+#include "trace.h"
+#include "decomp.h"
+#include "textparse.h"
+#include "compact.h"
+#include "sample.h"
+#include "sweep.h"
+#include "shard.h"
+#include "checkpoint.h"
 
-FILE *stream;
-char *buf = NULL;
-size_t len = 0;
+const char *tracePath;
+int traceFormat;
+int useMmap;
+int useAsync;
+uint64_t traceSkip;
+uint64_t traceCount;
+TraceReader *reader;
+Predictor *predictor;
+
+// Sampling: every period of the trace fast-forwards sampleSkip
+// branches, warms the predictor up over sampleWarmup and measures
+// sampleMeasure. A SimPoint file replaces the periods with its own
+// intervals
+int sampling;
+uint64_t sampleSkip;
+uint64_t sampleWarmup;
+uint64_t sampleMeasure;
+int fastForward;
+const char *simpointsPath;
+
+// Predictor types of --predictors, run side by side over one pass of
+// the trace. Empty for a run of the single --<type> predictor
+std::vector<int> predictorTypes;
+
+// Sweep file of --sweep, NULL when not sweeping
+const char *sweepPath;
+
+// Checkpoints: --save-checkpoint saves the predictor once the first
+// checkpointAt branches of the trace are simulated, --load-checkpoint
+// goes on from a saved one. NULL when not in use
+const char *saveCheckpointPath;
+uint64_t checkpointAt;
+const char *loadCheckpointPath;
+
+// Set when --<type> or --tage-config is given, which a loaded
+// checkpoint has to agree with
+int typeGiven;
+int tageConfigGiven;
+
+// Fast-forwards that skip at least this many branches seek through the
+// index of a compact trace instead of decoding the branches
+#define SAMPLE_SEEK_MIN (1 << 20)
+
+// Block of records decoded ahead of read_branch
+const branch_record *batch;
+size_t batch_len = 0;
+size_t batch_pos = 0;
 
 // Print out the Usage information to stderr
 //
 void usage()
 {
   fprintf(stderr, "Usage: predictor <options> [<trace>]\n");
+  fprintf(stderr, "       predictor <options> trace.bz2\n");
+  fprintf(stderr, "       predictor <options> traces.playlist\n");
   fprintf(stderr, "       bunzip2 -kc trace.bz2 | predictor <options>\n");
   fprintf(stderr, " Options:\n");
   fprintf(stderr, " --help       Print this message\n");
   fprintf(stderr, " --verbose    Print predictions on stdout\n");
+  fprintf(stderr, " --trace-format=<format>  Trace encoding:\n");
+  fprintf(stderr, "    auto (default, sniffed from the input)\n"
+                  "    text\n"
+                  "    bin  (see tracecvt)\n"
+                  "    compact  (see tracecvt)\n");
+  fprintf(stderr, " --text-parser=<parser>  Text trace parser:\n");
+  fprintf(stderr, "    auto (default, best SIMD the CPU has)\n"
+                  "    avx2\n"
+                  "    sse4.2\n"
+                  "    scalar\n"
+                  "    sscanf (the original parser)\n");
+  fprintf(stderr, " --skip=<n>   Start simulating at branch <n>, with the global\n"
+                  "              history of the branches before it\n");
+  fprintf(stderr, " --count=<n>  Simulate at most <n> branches\n");
+  fprintf(stderr, " --sample=<ff>,<warmup>,<measure>  Sampled simulation: every\n"
+                  "              <ff>+<warmup>+<measure> branches, fast-forward <ff>,\n"
+                  "              warm up over <warmup>, measure <measure>\n");
+  fprintf(stderr, " --fast-forward=<mode>  Branches fast-forwarded while sampling:\n");
+  fprintf(stderr, "    skip (default, only the global history is kept)\n"
+                  "    warm (the predictor is trained)\n");
+  fprintf(stderr, " --simpoints=<file>  Measure the \"<interval> <weight>\" SimPoints\n"
+                  "              in <file> instead, intervals of <measure> branches\n");
+  fprintf(stderr, " --playlist-cache=<MiB>  Memory for the traces a .playlist\n"
+                  "              replays (default 1024)\n");
+  fprintf(stderr, " --no-mmap    Read <trace> through stdio instead of mapping it\n");
+  fprintf(stderr, " --no-async   Decode the trace on the simulation thread\n");
+  fprintf(stderr, " --decomp-threads=<n>  Threads decompressing a .bz2/.zst <trace>\n"
+                  "                       (default one per core)\n");
   fprintf(stderr, " --<type>     Branch prediction scheme:\n");
   fprintf(stderr, "    static\n"
                   "    gshare\n"
                   "    tage\n"
                   "    custom\n");
+  fprintf(stderr, " --tage-config=<name>  TAGE geometry, each with a kernel\n"
+                  "              compiled for it:\n");
+  fprintf(stderr, "    default (T1..T4 of 4 to 64K entries, histories 2,4,8,16)\n"
+                  "    short   (4 tables of 1K entries, histories 4 to 64)\n"
+                  "    long    (8 tables of 1K entries, histories 4 to 640)\n");
+  fprintf(stderr, " --tage-lookup=<lookup>  How TAGE looks up its tables:\n");
+  fprintf(stderr, "    auto (default, avx2 when the CPU has it)\n"
+                  "    avx2 (eight tables at a time)\n"
+                  "    scalar\n");
+  fprintf(stderr, " --tage-aging=<aging>  How TAGE applies usefulness resets:\n");
+  fprintf(stderr, "    lazy  (default, over the branches after each)\n"
+                  "    eager (to every entry at once)\n");
+  fprintf(stderr, " --lookahead=<k>  Prefetch the table lines of the branch <k>\n"
+                  "              branches ahead, 0 for none (default 0, at most 64)\n");
+  fprintf(stderr, " --predictors=<type>,<type>,...  Run several predictors over\n"
+                  "              one pass of the trace and compare them\n");
+  fprintf(stderr, " --sweep=<file>  Run every predictor configuration in <file>\n"
+                  "              over one in-memory copy of the trace, e.g. lines\n"
+                  "              gshare:hist=10..20\n"
+                  "              tage:L=2/4/8/16,1/2/4/8:tag=2..8:reset=262114\n");
+  fprintf(stderr, " --sweep-threads=<n>  Threads running the sweep (default one\n"
+                  "                      per core)\n");
+  fprintf(stderr, " --interleave=<k>  Configurations each sweep thread steps in\n"
+                  "              turn, a branch of each, prefetching for the next\n"
+                  "              (default 1)\n");
+  fprintf(stderr, " --shards=<n>  Split the trace into <n> shards simulated on a\n"
+                  "              thread each, merging their statistics (default 1)\n");
+  fprintf(stderr, " --shard-warmup=<n>  Branches before a shard it replays to warm\n"
+                  "              up, not counted (default 1000000)\n");
+  fprintf(stderr, " --shard-check  Run the sequential simulation as well and\n"
+                  "              report the error of the shards against it\n");
+  fprintf(stderr, " --save-checkpoint=<n>,<file>  Save the predictor and statistics\n"
+                  "              to <file> once branch <n> of the trace is reached\n");
+  fprintf(stderr, " --load-checkpoint=<file>  Go on from the checkpoint in <file>,\n"
+                  "              at its branch and with its predictor and statistics\n");
+}
+
+// Parses the comma separated predictor types of --predictors
+//
+// Returns False if a type is unknown
+//
+int parse_predictors(const char *list)
+{
+  predictorTypes.clear();
+  while (*list)
+  {
+    size_t len = strcspn(list, ",");
+    int type = -1;
+    for (int i = 0; i < 4; i++)
+    {
+      if (strlen(bpName[i]) == len && !strncasecmp(list, bpName[i], len))
+      {
+        type = i;
+      }
+    }
+    if (type < 0)
+    {
+      return 0;
+    }
+    predictorTypes.push_back(type);
+    list += len;
+    if (*list == ',')
+    {
+      list++;
+    }
+  }
+  return !predictorTypes.empty();
 }
 
 // Process an option and update the predictor
@@ -39,23 +190,146 @@ int handle_option(char *arg)
   if (!strcmp(arg, "--static"))
   {
     bpType = STATIC;
+    typeGiven = 1;
   }
   else if (!strncmp(arg, "--gshare", 8))
   {
     bpType = GSHARE;
+    typeGiven = 1;
   }
   else if (!strncmp(arg, "--tage", 12))
   {
     bpType = TAGE;
+    typeGiven = 1;
+  }
+  else if (!strncmp(arg, "--tage-config=", 14))
+  {
+    tageConfigGiven = 1;
+    return set_tage_config(arg + 14);
+  }
+  else if (!strncmp(arg, "--tage-lookup=", 14))
+  {
+    return parse_tage_lookup(arg + 14);
+  }
+  else if (!strncmp(arg, "--tage-aging=", 13))
+  {
+    return parse_tage_aging(arg + 13);
   }
   else if (!strncmp(arg, "--custom", 8))
   {
     bpType = CUSTOM;
+    typeGiven = 1;
+  }
+  else if (!strncmp(arg, "--lookahead=", 12))
+  {
+    lookahead = atoi(arg + 12);
+    return lookahead >= 0 && lookahead <= MAX_LOOKAHEAD;
+  }
+  else if (!strncmp(arg, "--predictors=", 13))
+  {
+    return parse_predictors(arg + 13);
+  }
+  else if (!strncmp(arg, "--sweep=", 8))
+  {
+    sweepPath = arg + 8;
+  }
+  else if (!strncmp(arg, "--sweep-threads=", 16))
+  {
+    sweepThreads = atoi(arg + 16);
+    return sweepThreads >= 0;
+  }
+  else if (!strncmp(arg, "--interleave=", 13))
+  {
+    sweepInterleave = atoi(arg + 13);
+    return sweepInterleave >= 1;
+  }
+  else if (!strncmp(arg, "--shards=", 9))
+  {
+    shardCount = atoi(arg + 9);
+    return shardCount >= 1;
+  }
+  else if (!strncmp(arg, "--shard-warmup=", 15))
+  {
+    shardWarmup = strtoull(arg + 15, NULL, 0);
+  }
+  else if (!strcmp(arg, "--shard-check"))
+  {
+    shardCheck = 1;
+  }
+  else if (!strncmp(arg, "--save-checkpoint=", 18))
+  {
+    char *end;
+    checkpointAt = strtoull(arg + 18, &end, 0);
+    if (*end != ',' || end[1] == 0)
+    {
+      return 0;
+    }
+    saveCheckpointPath = end + 1;
+  }
+  else if (!strncmp(arg, "--load-checkpoint=", 18))
+  {
+    loadCheckpointPath = arg + 18;
   }
   else if (!strcmp(arg, "--verbose"))
   {
     verbose = 1;
   }
+  else if (!strncmp(arg, "--trace-format=", 15))
+  {
+    traceFormat = parse_trace_format(arg + 15);
+    return traceFormat >= 0;
+  }
+  else if (!strncmp(arg, "--text-parser=", 14))
+  {
+    textParser = parse_text_parser(arg + 14);
+    return textParser >= 0;
+  }
+  else if (!strncmp(arg, "--skip=", 7))
+  {
+    traceSkip = strtoull(arg + 7, NULL, 0);
+  }
+  else if (!strncmp(arg, "--count=", 8))
+  {
+    traceCount = strtoull(arg + 8, NULL, 0);
+  }
+  else if (!strncmp(arg, "--sample=", 9))
+  {
+    unsigned long long ff, warmup, measure;
+    char extra;
+    sampling = 1;
+    if (sscanf(arg + 9, "%llu,%llu,%llu%c", &ff, &warmup, &measure, &extra) != 3 || measure == 0)
+    {
+      return 0;
+    }
+    sampleSkip = ff;
+    sampleWarmup = warmup;
+    sampleMeasure = measure;
+  }
+  else if (!strncmp(arg, "--fast-forward=", 15))
+  {
+    fastForward = parse_ff_mode(arg + 15);
+    return fastForward >= 0;
+  }
+  else if (!strncmp(arg, "--simpoints=", 12))
+  {
+    simpointsPath = arg + 12;
+  }
+  else if (!strncmp(arg, "--playlist-cache=", 17))
+  {
+    playlistCache = atoi(arg + 17);
+  }
+  else if (!strcmp(arg, "--no-mmap"))
+  {
+    useMmap = 0;
+  }
+  else if (!strcmp(arg, "--no-async"))
+  {
+    useAsync = 0;
+  }
+  else if (!strncmp(arg, "--decomp-threads=", 17))
+  {
+    decompThreads = atoi(arg + 17);
+  }
   else
   {
     return 0;
@@ -64,29 +338,288 @@ int handle_option(char *arg)
   return 1;
 }
 
-// Reads a line from the input stream and extracts the
-// PC and Outcome of a branch
+// Extracts the PC and Outcome of the next branch, decoding
+// a new block of records from the trace when needed
 //
 // Returns True if Successful
 //
 int read_branch(uint32_t *pc, uint32_t *target, uint32_t *outcome, uint32_t *condition, uint32_t *call, uint32_t *ret, uint32_t *direct)
 {
-  if (getline(&buf, &len, stream) == -1)
+  if (batch_pos == batch_len)
   {
-    return 0;
+    batch_len = reader->next_batch(&batch);
+    batch_pos = 0;
+    if (batch_len == 0)
+    {
+      return 0;
+    }
   }
 
-  sscanf(buf, "0x%x\t0x%x\t%d\t%d\t%d\t%d\t%d\n", pc, target, outcome, condition, call, ret, direct);
+  const branch_record *rec = &batch[batch_pos++];
+  *pc = rec->pc;
+  *target = rec->target;
+  *outcome = (rec->flags & TRACE_OUTCOME) ? 1 : 0;
+  *condition = (rec->flags & TRACE_CONDITION) ? 1 : 0;
+  *call = (rec->flags & TRACE_CALL) ? 1 : 0;
+  *ret = (rec->flags & TRACE_RET) ? 1 : 0;
+  *direct = (rec->flags & TRACE_DIRECT) ? 1 : 0;
 
   return 1;
 }
 
+// Simulates one branch, counting it in 'interval' unless that is NULL
+//
+static inline void simulate_branch(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition,
+                                   uint32_t call, uint32_t ret, uint32_t direct, sample_interval *interval)
+{
+  if (condition == 1)
+  {
+    uint32_t prediction = predictor->predict(pc, target, direct);
+    if (interval != NULL)
+    {
+      interval->branches++;
+      if (prediction != outcome)
+      {
+        interval->mispredictions++;
+      }
+      if (verbose != 0)
+      {
+        printf("%d\n", prediction);
+      }
+    }
+  }
+  predictor->train(pc, target, outcome, condition, call, ret, direct);
+}
+
+// Runs a sampled simulation: for every interval, fast-forwards up to its
+// warmup, simulates the warmup without counting it, then measures the
+// interval. 'history' is the history snapshot at the start of the run
+//
+// Returns the measured intervals
+//
+std::vector<sample_interval> simulate_sampled(uint64_t *history)
+{
+  std::vector<sample_interval> intervals;
+  if (simpointsPath != NULL && !load_simpoints(simpointsPath, sampleMeasure, intervals))
+  {
+    exit(1);
+  }
+
+  uint32_t pc, target, outcome, condition, call, ret, direct;
+  uint64_t pos = 0;
+  int seekable = (tracePath != NULL);
+  for (size_t i = 0; simpointsPath == NULL || i < intervals.size(); i++)
+  {
+    if (simpointsPath == NULL)
+    {
+      sample_interval s;
+      memset(&s, 0, sizeof(s));
+      s.start = i * (sampleSkip + sampleWarmup + sampleMeasure) + sampleSkip + sampleWarmup;
+      s.length = sampleMeasure;
+      intervals.push_back(s);
+    }
+    sample_interval *s = &intervals[i];
+    uint64_t warm_start = std::max(pos, s->start - std::min(s->start, sampleWarmup));
+
+    // fast-forward, seeking through the index of a compact trace when
+    // there is a long way to go
+    if (fastForward == FF_SKIP && seekable && warm_start - pos >= SAMPLE_SEEK_MIN)
+    {
+      uint64_t left = traceCount ? traceCount - std::min(traceCount, warm_start) : 0;
+      TraceReader *seek = (traceCount && left == 0) ? NULL :
+                          open_indexed_trace(tracePath, traceSkip + warm_start, left, history);
+      if (seek != NULL)
+      {
+        delete reader;
+        reader = seek;
+        batch_len = batch_pos = 0;
+        pos = warm_start;
+      }
+      seekable = (seek != NULL);
+    }
+    for (; pos < warm_start; pos++)
+    {
+      if (!read_branch(&pc, &target, &outcome, &condition, &call, &ret, &direct))
+      {
+        intervals.resize(i);
+        return intervals;
+      }
+      if (fastForward == FF_WARM)
+      {
+        simulate_branch(pc, target, outcome, condition, call, ret, direct, NULL);
+      }
+      else if (condition)
+      {
+        push_history(history, outcome);
+      }
+    }
+    if (fastForward == FF_SKIP)
+    {
+      predictor->seed_history(history);
+    }
+
+    // warm up, then measure
+    for (; pos < s->start + s->length; pos++)
+    {
+      if (!read_branch(&pc, &target, &outcome, &condition, &call, &ret, &direct))
+      {
+        if (pos <= s->start)
+        {
+          intervals.resize(i);
+        }
+        return intervals;
+      }
+      simulate_branch(pc, target, outcome, condition, call, ret, direct, pos >= s->start ? s : NULL);
+      if (condition)
+      {
+        push_history(history, outcome);
+      }
+    }
+    s->complete = 1;
+  }
+  return intervals;
+}
+
+// Runs the predictors of --predictors in lockstep, each branch decoded
+// once and handed to all of them, then prints the statistics of every
+// predictor and how often each pair agreed. 'history' seeds them when
+// the run starts mid-trace
+//
+void simulate_predictors(const uint64_t *history)
+{
+  size_t n = predictorTypes.size();
+  std::vector<Predictor *> bps(n);
+  for (size_t i = 0; i < n; i++)
+  {
+    bps[i] = create_predictor(predictorTypes[i]);
+    if (traceSkip > 0)
+    {
+      bps[i]->seed_history(history);
+    }
+  }
+
+  // right[i * n + j]: branches predictor i got right and j got wrong
+  uint64_t num_branches = 0;
+  uint64_t unanimous = 0;
+  std::vector<uint64_t> mispredictions(n, 0);
+  std::vector<uint64_t> right(n * n, 0);
+  std::vector<uint32_t> prediction(n);
+  uint32_t pc, target, outcome, condition, call, ret, direct;
+
+  while (read_branch(&pc, &target, &outcome, &condition, &call, &ret, &direct))
+  {
+    if (condition == 1)
+    {
+      num_branches++;
+      int all = 1;
+      for (size_t i = 0; i < n; i++)
+      {
+        prediction[i] = bps[i]->predict(pc, target, direct);
+        if (prediction[i] != outcome)
+        {
+          mispredictions[i]++;
+        }
+        if (prediction[i] != prediction[0])
+        {
+          all = 0;
+        }
+        if (verbose != 0)
+        {
+          printf(i + 1 < n ? "%d " : "%d\n", prediction[i]);
+        }
+      }
+      unanimous += all;
+      if (!all)
+      {
+        for (size_t i = 0; i < n; i++)
+        {
+          for (size_t j = 0; j < n; j++)
+          {
+            right[i * n + j] += (prediction[i] == outcome && prediction[j] != outcome);
+          }
+        }
+      }
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+      bps[i]->train(pc, target, outcome, condition, call, ret, direct);
+    }
+  }
+
+  for (size_t i = 0; i < n; i++)
+  {
+    printf("%s======= %s =======\n\n", i ? "\n" : "", bpName[predictorTypes[i]]);
+    printf("Branches:        %10llu\n", (unsigned long long)num_branches);
+    printf("Incorrect:       %10llu\n", (unsigned long long)mispredictions[i]);
+    float mispredict_rate = 100 * ((float)mispredictions[i] / (float)num_branches);
+    printf("Misprediction Rate: %7.3f percent\n", mispredict_rate);
+    bps[i]->dbg_prints();
+  }
+
+  // two predictors that disagree cannot both be right or both be wrong
+  printf("\n======= Agreement =======\n\n");
+  printf("All agree:       %10llu  (%7.3f percent)\n", (unsigned long long)unanimous,
+         num_branches ? 100.0 * unanimous / num_branches : 0.0);
+  for (size_t i = 0; i < n; i++)
+  {
+    for (size_t j = i + 1; j < n; j++)
+    {
+      uint64_t differ = right[i * n + j] + right[j * n + i];
+      printf("%s vs %s: agree %10llu  disagree %10llu  (%s right %llu, %s right %llu)\n",
+             bpName[predictorTypes[i]], bpName[predictorTypes[j]],
+             (unsigned long long)(num_branches - differ), (unsigned long long)differ,
+             bpName[predictorTypes[i]], (unsigned long long)right[i * n + j],
+             bpName[predictorTypes[j]], (unsigned long long)right[j * n + i]);
+    }
+  }
+
+  for (size_t i = 0; i < n; i++)
+  {
+    delete bps[i];
+  }
+}
+
+// Simulates 'n' records with the predictor, adding to the counts and
+// printing the predictions with --verbose
+//
+void simulate_records(const branch_record *recs, size_t n, uint64_t *num_branches, uint64_t *mispredictions)
+{
+  static branch_columns columns;
+  static std::vector<uint64_t> predictions;
+  columns.assign(recs, n);
+  predictions.resize((n + 63) / 64);
+  predictor->predict_batch(columns.view(0, n), num_branches, mispredictions, verbose ? predictions.data() : NULL);
+  if (verbose != 0)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      if (recs[i].flags & TRACE_CONDITION)
+      {
+        printf("%d\n", (int)(predictions[i / 64] >> (i % 64)) & 1);
+      }
+    }
+  }
+}
+
 int main(int argc, char *argv[])
 {
   // Set defaults
-  stream = stdin;
+  tracePath = NULL;
+  useMmap = 1;
+  useAsync = 1;
+  traceSkip = 0;
+  traceCount = 0;
+  sampling = 0;
+  fastForward = FF_SKIP;
+  simpointsPath = NULL;
+  sweepPath = NULL;
+  saveCheckpointPath = NULL;
+  loadCheckpointPath = NULL;
+  typeGiven = 0;
+  tageConfigGiven = 0;
   bpType = STATIC;
   verbose = 0;
+  traceFormat = TRACE_FMT_AUTO;
 
   // Process cmdline Arguments
   for (int i = 1; i < argc; ++i)
@@ -108,57 +641,273 @@ int main(int argc, char *argv[])
     else
     {
       // Use as input file
-      stream = fopen(argv[i], "r");
+      tracePath = argv[i];
     }
   }
 
+  std::vector<sweep_point> points;
+  if (sweepPath != NULL)
+  {
+    if (sampling || !predictorTypes.empty() || shardCount > 1)
+    {
+      fprintf(stderr, "--sweep does not combine with --sample, --predictors or --shards\n");
+      exit(1);
+    }
+    if (!load_sweep(sweepPath, points))
+    {
+      exit(1);
+    }
+  }
+
+  // A checkpoint only goes with a plain run: the predictor comes from
+  // it, and the trace starts where it was saved
+  checkpoint_header checkpoint;
+  memset(&checkpoint, 0, sizeof(checkpoint));
+  if (saveCheckpointPath != NULL || loadCheckpointPath != NULL)
+  {
+    if (sweepPath != NULL || sampling || !predictorTypes.empty() || shardCount > 1)
+    {
+      fprintf(stderr, "checkpoints do not combine with --sweep, --sample, --predictors or --shards\n");
+      exit(1);
+    }
+  }
+  if (loadCheckpointPath != NULL)
+  {
+    if (traceSkip > 0)
+    {
+      fprintf(stderr, "--load-checkpoint starts where the checkpoint was saved, not at --skip\n");
+      exit(1);
+    }
+    predictor = load_checkpoint(loadCheckpointPath, &checkpoint);
+    if (predictor == NULL)
+    {
+      exit(1);
+    }
+    traceSkip = checkpoint.position;
+
+    // the predictor comes from the checkpoint, so one asked for on the
+    // command line has to be the same
+    const predictor_config &saved = checkpoint.config;
+    predictor_config asked;
+    default_config(&asked, typeGiven ? bpType : saved.bpType);
+    int tables = saved.tageTables;
+    if (asked.bpType != saved.bpType)
+    {
+      fprintf(stderr, "%s holds a %s predictor, not %s\n", loadCheckpointPath,
+              bpName[saved.bpType], bpName[asked.bpType]);
+      exit(1);
+    }
+    if (tageConfigGiven && saved.bpType == TAGE &&
+        (asked.tageTables != tables || asked.tageWays != saved.tageWays ||
+         memcmp(asked.tageBits, saved.tageBits, (tables + 1) * sizeof(uint32_t)) ||
+         memcmp(asked.tageHistory, saved.tageHistory, (tables + 1) * sizeof(uint32_t)) ||
+         memcmp(asked.tageTagBits, saved.tageTagBits, (tables + 1) * sizeof(uint32_t))))
+    {
+      fprintf(stderr, "%s holds a %s predictor of another geometry than --tage-config\n", loadCheckpointPath,
+              bpName[saved.bpType]);
+      exit(1);
+    }
+  }
+  else
+  {
+    default_config(&checkpoint.config, bpType);
+  }
+  if (saveCheckpointPath != NULL && checkpointAt < traceSkip)
+  {
+    fprintf(stderr, "--save-checkpoint at branch %llu, before the run starts at %llu\n",
+            (unsigned long long)checkpointAt, (unsigned long long)traceSkip);
+    exit(1);
+  }
+  if (saveCheckpointPath != NULL && traceCount > 0 && checkpointAt >= traceSkip + traceCount)
+  {
+    fprintf(stderr, "--save-checkpoint at branch %llu, after the run ends at %llu\n",
+            (unsigned long long)checkpointAt, (unsigned long long)(traceSkip + traceCount));
+    exit(1);
+  }
+
+  // Open the trace, mapping it in place when it is a regular file and
+  // seeking to --skip through the index of a compact trace. The records
+  // hashed after a checkpoint are read even past --count
+  uint64_t history[HISTORY_SNAPSHOT_WORDS];
+  uint64_t count = traceCount;
+  if (loadCheckpointPath != NULL && count > 0)
+  {
+    count = std::max(count, checkpoint.follow);
+  }
+  if (saveCheckpointPath != NULL && count > 0)
+  {
+    count = std::max(count, checkpointAt - traceSkip + CHECKPOINT_FOLLOW);
+  }
+  reader = open_trace_range(tracePath, traceFormat, useMmap, traceSkip, count, history);
+  if (reader == NULL)
+  {
+    exit(1);
+  }
+  // Decode ahead on a separate thread while the predictor runs
+  if (useAsync)
+  {
+    reader = new AsyncTraceReader(reader);
+  }
+
+  if (sweepPath != NULL)
+  {
+    // decode the trace once, for all the points to share
+    branch_columns recs;
+    load_records(reader, recs);
+    delete reader;
+    run_sweep(recs, traceSkip > 0 ? history : NULL, points);
+    print_sweep(points);
+    return 0;
+  }
+  if (shardCount > 1)
+  {
+    if (sampling || !predictorTypes.empty() || verbose)
+    {
+      fprintf(stderr, "--shards does not combine with --sample, --predictors or --verbose\n");
+      exit(1);
+    }
+    branch_columns recs;
+    load_records(reader, recs);
+    delete reader;
+    std::vector<shard_result> shards;
+    shard_result exact;
+    run_shards(recs, traceSkip > 0 ? history : NULL, bpType, shards, shardCheck ? &exact : NULL);
+    print_shards(shards, shardCheck ? &exact : NULL);
+    return 0;
+  }
+  if (!predictorTypes.empty())
+  {
+    if (sampling)
+    {
+      fprintf(stderr, "--predictors does not combine with --sample\n");
+      exit(1);
+    }
+    simulate_predictors(history);
+    delete reader;
+    return 0;
+  }
+
   // Initialize the predictor
-  init_predictor();
-
-  uint32_t num_branches = 0;
-  uint32_t mispredictions = 0;
-  uint32_t pc = 0;
-  uint32_t target = 0;
-  uint32_t outcome = NOTTAKEN;
-  uint32_t condition = 0;
-  uint32_t call = 0;
-  uint32_t ret = 0;
-  uint32_t direct = 0;
-
-  // Reach each branch from the trace
-  while (read_branch(&pc, &target, &outcome, &condition, &call, &ret, &direct))
+  if (loadCheckpointPath == NULL)
   {
-    if (condition == 1)
+    predictor = create_predictor(bpType);
+    if (traceSkip > 0)
     {
-      num_branches++;
-      // Make a prediction and compare with actual outcome
-      uint32_t prediction = make_prediction(pc, target, direct);
-      if (prediction != outcome)
+      predictor->seed_history(history);
+    }
+  }
+
+  if (simpointsPath != NULL && !sampling)
+  {
+    fprintf(stderr, "--simpoints needs --sample=0,<warmup>,<measure>\n");
+    exit(1);
+  }
+  if (sampling)
+  {
+    print_samples(simulate_sampled(history), simpointsPath != NULL);
+    predictor->dbg_prints();
+    delete predictor;
+    delete reader;
+    return 0;
+  }
+
+  uint64_t num_branches = checkpoint.branches;
+  uint64_t mispredictions = checkpoint.mispredictions;
+  uint64_t position = traceSkip;
+  uint64_t end = traceCount ? traceSkip + traceCount : UINT64_MAX;
+  std::vector<uint8_t> pending;
+  checkpoint_follow saving = {0, 0};
+  checkpoint_follow loading = {0, 0};
+  int taken = (saveCheckpointPath == NULL);
+  int written = taken;
+  const branch_record *recs;
+  size_t n;
+
+  // Hand the predictor whole batches of records, as columns, split
+  // where the checkpoint is taken. The records after a checkpoint are
+  // hashed, to write with the one saved and to check the one loaded
+  // against
+  for (;;)
+  {
+    if (!taken && position == checkpointAt && position <= end)
+    {
+      take_checkpoint(pending, predictor, &checkpoint.config, position, num_branches, mispredictions);
+      taken = 1;
+    }
+    if ((n = reader->next_batch(&recs)) == 0)
+    {
+      break;
+    }
+    if (!written)
+    {
+      follow_records(&saving, checkpointAt, position, recs, n);
+    }
+    if (loadCheckpointPath != NULL)
+    {
+      follow_records(&loading, checkpoint.position, position, recs, n);
+      if (loading.count == checkpoint.follow && loading.hash != checkpoint.follow_hash && checkpoint.follow > 0)
       {
-        mispredictions++;
+        fprintf(stderr, "%s: the trace does not match the checkpoint\n", loadCheckpointPath);
+        exit(1);
       }
-      if (verbose != 0)
+    }
+
+    size_t run = (size_t)std::min((uint64_t)n, end - std::min(end, position));
+    size_t part = (!taken && checkpointAt - position < run) ? checkpointAt - position : run;
+    simulate_records(recs, part, &num_branches, &mispredictions);
+    if (part < run)
+    {
+      take_checkpoint(pending, predictor, &checkpoint.config, position + part, num_branches, mispredictions);
+      taken = 1;
+      simulate_records(recs + part, run - part, &num_branches, &mispredictions);
+    }
+    position += n;
+
+    if (taken && !written && position >= checkpointAt + CHECKPOINT_FOLLOW)
+    {
+      if (!write_checkpoint(saveCheckpointPath, pending, &saving))
       {
-        printf("%d\n", prediction);
+        exit(1);
       }
+      written = 1;
+    }
+  }
+  if (taken && !written && !write_checkpoint(saveCheckpointPath, pending, &saving))
+  {
+    exit(1);
+  }
+  if (!taken)
+  {
+    fprintf(stderr, "The trace ended at branch %llu, before the checkpoint at %llu\n",
+            (unsigned long long)std::min(position, end), (unsigned long long)checkpointAt);
+    exit(1);
+  }
+  if (loadCheckpointPath != NULL && loading.count != checkpoint.follow)
+  {
+    if (loading.count == 0)
+    {
+      fprintf(stderr, "%s: the trace ends before branch %llu of the checkpoint\n", loadCheckpointPath,
+              (unsigned long long)checkpoint.position);
+    }
+    else
+    {
+      fprintf(stderr, "%s: the trace does not match the checkpoint\n", loadCheckpointPath);
     }
-    // Train the predictor
-    train_predictor(pc, target, outcome, condition, call, ret, direct);
+    exit(1);
   }
 
   // Print out the mispredict statistics
-  printf("Branches:        %10d\n", num_branches);
-  printf("Incorrect:       %10d\n", mispredictions);
+  printf("Branches:        %10llu\n", (unsigned long long)num_branches);
+  printf("Incorrect:       %10llu\n", (unsigned long long)mispredictions);
   float mispredict_rate = 100 * ((float)mispredictions / (float)num_branches);
   printf("Misprediction Rate: %7.3f percent\n", mispredict_rate);
   
   //print debug variables
-  if(bpType == TAGE)
-  	dbg_prints();
+  predictor->dbg_prints();
 
   // Cleanup
-  fclose(stream);
-  free(buf);
+  delete predictor;
+  delete reader;
 
   return 0;
 }
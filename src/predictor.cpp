@@ -7,9 +7,16 @@
 //========================================================//
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 #include <algorithm>
 #include <cstdlib>
+#include <immintrin.h>
 #include "predictor.h"
+#include "trace.h"
+#include "counters.h"
+
+static_assert(TAGE_MAX_HISTORY <= 64 * HISTORY_SNAPSHOT_WORDS,
+              "a seeded TAGE history has to fit in a history snapshot");
 
 //------------------------------------//
 //      Predictor Configuration       //
@@ -23,106 +30,468 @@ const char *bpName[4] = {"Static", "Gshare",
 int ghistoryBits = 18; // Number of bits used for Global History
 int bpType;            // Branch Prediction Type
 int verbose;
-int tag_size = 5;
-int tag_mask = (1 << tag_size) - 1;
+int lookahead = 0;
 
 //------------------------------------//
 //      Predictor Data Structures     //
 //------------------------------------//
 
-//tage (5 component)
-uint32_t L0 = 10; //2^10 entries in table T0 (not part of the geometric series, but defining L0 for convenience)
+// TAGE geometries with kernels compiled for them, picked by name with
+// --tage-config. T0 has 2^bits[0] entries, T1..Tn 2^bits[t] entries
+// indexed with history[t] branches of history and tagged with
+// tag_bits[t] bits. Any other geometry runs on the generic kernel
+
+//default tage (5 component)
 //for the geometric series, pick r as 4, to see the effect of long history lengths
 //FIXME try with r as 2
-uint32_t L1 = 2;  
-uint32_t L2 = 4;  
-uint32_t L3 = 8;  
-uint32_t L4 = 16;  
-
-uint32_t T0_entries = 1 << L0;
-uint32_t T1_entries = 1 << L1;
-uint32_t T2_entries = 1 << L2;
-uint32_t T3_entries = 1 << L3;
-uint32_t T4_entries = 1 << L4;
-
-//the _pred are the 3-bit counter predictor tables
-//the _u are 2-bit counter usefulness tables
-int8_t * T0_pred;
-
-int8_t * T1_pred;
-uint8_t * T1_u;
-uint8_t * T1_valid;
-uint8_t * T1_tag;
-
-int8_t * T2_pred;
-uint8_t * T2_u;
-uint8_t * T2_valid;
-uint8_t * T2_tag;
-
-int8_t * T3_pred;
-uint8_t * T3_u;
-uint8_t * T3_valid;
-uint8_t * T3_tag;
-
-int8_t * T4_pred;
-uint8_t * T4_u;
-uint8_t * T4_valid;
-uint8_t * T4_tag;
-
-
-//global counter for how many branches have been predicted so far
-//will be used in resetting the u values
-uint64_t tage_branch_count; 
-
-uint8_t T0_idx;
-uint8_t T1_idx;
-uint8_t T2_idx;
-uint8_t T3_idx;
-uint8_t T4_idx;
-
-//default prediction from T0
-uint8_t default_pred; 
-//final prediction
-uint8_t pred;
-//who is the provider
-uint8_t provider; 
-//altpred
-uint8_t altpred;
+struct tage_default_geometry
+{
+  static constexpr int tables = 4;
+  static constexpr uint32_t bits[5] = {10, 2, 4, 8, 16};
+  static constexpr uint32_t history[5] = {0, 2, 4, 8, 16};
+  static constexpr uint32_t tag_bits[5] = {0, 5, 5, 5, 5};
+};
+
+// four 1K-entry tables over histories of 4 to 64
+struct tage_short_geometry
+{
+  static constexpr int tables = 4;
+  static constexpr uint32_t bits[5] = {10, 10, 10, 10, 10};
+  static constexpr uint32_t history[5] = {0, 4, 10, 25, 64};
+  static constexpr uint32_t tag_bits[5] = {0, 9, 9, 9, 9};
+};
+
+// eight 1K-entry tables over histories of 4 to 640
+struct tage_long_geometry
+{
+  static constexpr int tables = 8;
+  static constexpr uint32_t bits[9] = {10, 10, 10, 10, 10, 10, 10, 10, 10};
+  static constexpr uint32_t history[9] = {0, 4, 8, 17, 35, 73, 150, 310, 640};
+  static constexpr uint32_t tag_bits[9] = {0, 10, 10, 10, 10, 10, 10, 10, 10};
+};
+
+// Implements Predictor::predict_batch() and Predictor::step() for
+// predictor class P, with loops that call P's own predict() and train()
+// so they inline
+template <class P>
+class PredictorBase : public Predictor
+{
+public:
+  void predict_batch(const branch_batch &batch, uint64_t *branches, uint64_t *mispredictions, uint64_t *predictions);
+  size_t step(const branch_batch &batch, size_t i, uint64_t *branches, uint64_t *mispredictions);
+};
+
+class StaticPredictor final : public PredictorBase<StaticPredictor>
+{
+public:
+  uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct) { return TAKEN; }
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct) {}
+  void seed_history(const uint64_t *history) {}
+  void checkpoint(state_image &image) {}
+  void predict_batch(const branch_batch &batch, uint64_t *branches, uint64_t *mispredictions, uint64_t *predictions);
+};
+
+class CustomPredictor final : public PredictorBase<CustomPredictor>
+{
+public:
+  uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct) { return NOTTAKEN; }
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct) {}
+  void seed_history(const uint64_t *history) {}
+  void checkpoint(state_image &image) {}
+};
+
+// Shifts the newest outcome 'in' into 'value', the last outcomes of the
+// global history XORed down to 'width' bits, and cancels 'out', the one
+// dropping out of it. 'outpoint' is where that one lands: its history
+// length modulo the width. Keeps a history of any length current in
+// O(1) per branch
+//
+// Returns the new folded history
+//
+static inline uint32_t fold_history(uint32_t value, uint8_t in, uint8_t out, uint32_t width, uint32_t outpoint)
+{
+  value = (value << 1) | in;
+  value ^= (uint32_t)out << outpoint;
+  value ^= value >> width;
+  return value & ((1u << width) - 1);
+}
+
+// The folds of a tagged table: its history XORed down to the index
+// width, to the tag width, and to one bit less
+#define FOLD_INDEX 0
+#define FOLD_TAG 1
+#define FOLD_TAG2 2
+
+// Alignment of the tagged tables
+#define TAGE_LINE 64
+
+// A TAGE geometry read from a predictor_config at run time
+struct tage_geometry
+{
+  static constexpr int max_tables = TAGE_MAX_TABLES;
+  int tables;
+  uint32_t bits[TAGE_MAX_TABLES + 1];
+  uint32_t history[TAGE_MAX_TABLES + 1];
+  uint32_t tag_bits[TAGE_MAX_TABLES + 1];
+  uint32_t way_bits; // log2 of the ways of every tagged table
+  uint32_t width[TAGE_MAX_TABLES + 1][3];
+  uint32_t outpoint[TAGE_MAX_TABLES + 1][3];
+
+  void configure(const predictor_config *cfg)
+  {
+    tables = cfg->tageTables;
+    memcpy(bits, cfg->tageBits, sizeof(bits));
+    memcpy(history, cfg->tageHistory, sizeof(history));
+    memcpy(tag_bits, cfg->tageTagBits, sizeof(tag_bits));
+    way_bits = __builtin_ctz(cfg->tageWays);
+    for (int t = 1; t <= tables; t++)
+    {
+      // a set-associative table is indexed by set
+      width[t][FOLD_INDEX] = bits[t] - way_bits;
+      width[t][FOLD_TAG] = tag_bits[t];
+      width[t][FOLD_TAG2] = tag_bits[t] - 1;
+      for (int k = 0; k < 3; k++)
+      {
+        outpoint[t][k] = width[t][k] ? history[t] % width[t][k] : 0;
+      }
+    }
+  }
+  uint32_t fold_width(int t, int k) const { return width[t][k]; }
+  uint32_t fold_outpoint(int t, int k) const { return outpoint[t][k]; }
+};
+
+// A TAGE geometry fixed at compile time by S, one of the geometries
+// above. Every size, mask and shift of its kernel is a constant
+template <class S>
+struct tage_fixed_geometry : S
+{
+  static constexpr int max_tables = S::tables;
+  static constexpr uint32_t way_bits = 0; // direct-mapped
+
+  void configure(const predictor_config *cfg) {}
+  static constexpr uint32_t fold_width(int t, int k)
+  {
+    return k == FOLD_INDEX ? S::bits[t] : S::tag_bits[t] - (k == FOLD_TAG2);
+  }
+  static constexpr uint32_t fold_outpoint(int t, int k)
+  {
+    return fold_width(t, k) ? S::history[t] % fold_width(t, k) : 0;
+  }
+};
+
+// One entry of a tagged table, packed in 32 bits so a lookup or an
+// update touches a single cache line
+struct tage_entry
+{
+  uint16_t tag;
+  int8_t pred; // 3-bit signed prediction counter
+  uint8_t u;   // 2-bit usefulness counter, and TAGE_EPOCH
+};
+
+// The bit of tage_entry::u holding the parity of the last usefulness
+// reset applied to the entry. Resets are applied lazily: a reset only
+// flips the parity of the predictor, and an entry whose bit differs
+// has missed the last reset
+#define TAGE_EPOCH 0x04
+
+// Usefulness of a newly allocated entry, strongly not useful as per
+// the TAGE paper. make check builds with SU, so that tagged entries
+// provide and the usefulness resets change the results
+#ifndef TAGE_ALLOC_U
+#define TAGE_ALLOC_U SNU
+#endif
+
+// Applies the reset an entry has missed, if any, to its usefulness
+// 'u'. 'epoch' is TAGE_EPOCH after an odd number of resets, which
+// clear the MSB of every usefulness, and 0 after an even number, which
+// clear the LSB. Entries are never more than one reset behind
+//
+// Returns the usefulness with the reset applied
+//
+static inline uint8_t age_usefulness(uint8_t u, uint8_t epoch)
+{
+  uint8_t mask = epoch ? 0x01 : 0x02;
+  return ((u ^ epoch) & TAGE_EPOCH) ? (u & mask) | epoch : u;
+}
+
+// Tagged tables are handled in lanes, table t in lane t - 1, padded to
+// whole AVX2 vectors of eight
+#define TAGE_LANES(tables) (((tables) + 7) & ~7)
+
+// Branches whose sets and tags a batch keeps while it looks ahead, a
+// power of two above MAX_LOOKAHEAD
+#define TAGE_AHEAD 128
+
+// The tagged tables of a TAGE, one lane per table. All their entries
+// live in one allocation, so a single gather can reach every table
+template <int LANES>
+struct tage_lanes
+{
+  // the FOLD_INDEX, FOLD_TAG and FOLD_TAG2 folds of the history
+  alignas(32) uint32_t fold[3][LANES];
+
+  //entry and tag of the branch being predicted
+  alignas(32) uint32_t slot[LANES];
+  alignas(32) uint32_t branch_tag[LANES];
+
+  // the geometry, zero in the padding lanes
+  alignas(32) uint32_t base[LANES]; // first entry of the table
+  alignas(32) uint32_t index_mask[LANES];
+  alignas(32) uint32_t tag_mask[LANES];
+  alignas(32) uint32_t history[LANES];
+  alignas(32) uint32_t fold_mask[3][LANES];
+  alignas(32) uint32_t width[3][LANES];
+  alignas(32) uint32_t outpoint[3][LANES];
+};
+
+// Which lookup TagePredictor uses, TAGE_LOOKUP_* from --tage-lookup
+static int tageLookup = TAGE_LOOKUP_AUTO;
+
+const char *tageLookupName[3] = {"auto", "avx2", "scalar"};
+
+int parse_tage_lookup(const char *name)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    if (!strcmp(name, tageLookupName[i]))
+    {
+      tageLookup = i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Which aging TagePredictor uses, TAGE_AGING_* from --tage-aging
+static int tageAging = TAGE_AGING_LAZY;
+
+const char *tageAgingName[2] = {"lazy", "eager"};
+
+int parse_tage_aging(const char *name)
+{
+  for (int i = 0; i < 2; i++)
+  {
+    if (!strcmp(name, tageAgingName[i]))
+    {
+      tageAging = i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// one TAGE predictor: T0, a bimodal table, and T1..Tn tagged with
+// longer and longer global histories. G is its geometry, tage_geometry
+// or a tage_fixed_geometry. The loops over the tables are unrolled, so
+// with a fixed geometry each table gets code of its own. With AVX2 the
+// tables are looked up and their histories folded eight at a time
+// instead
+template <class G>
+class TagePredictor final : public PredictorBase<TagePredictor<G> >
+{
+public:
+  TagePredictor(const predictor_config *cfg);
+  ~TagePredictor();
+  uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct) { return tage_predict(pc); }
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+  {
+    if (condition)
+    {
+      train_tage(pc, outcome);
+      push_history(outcome);
+    }
+  }
+  void seed_history(const uint64_t *history);
+  void checkpoint(state_image &image);
+  void predict_batch(const branch_batch &batch, uint64_t *branches, uint64_t *mispredictions, uint64_t *predictions);
+  size_t step(const branch_batch &batch, size_t i, uint64_t *branches, uint64_t *mispredictions);
+  void dbg_prints();
+
+private:
+  static const int lanes = TAGE_LANES(G::max_tables);
+
+  void tage_index(uint32_t pc, uint32_t *slot, uint32_t *tag);
+  void tage_prefetch(uint32_t pc, uint32_t *slot, uint32_t *tag);
+  uint32_t tage_lookup(uint32_t pc, const uint32_t *slot, const uint32_t *tag);
+  void tage_walk(uint32_t pc, const uint32_t *slot, const uint32_t *tag);
+  uint8_t tage_predict(uint32_t pc, const uint32_t *slot = NULL, const uint32_t *tag = NULL);
+  void age_entries();
+  void train_tage(uint32_t pc, uint8_t outcome);
+  int choose_allocation();
+  void push_history(uint8_t outcome);
+  int tage_rand();
+
+  G geo; // tagged components T1..Tn, n = geo.tables
+  counter_table<2> T0; // 2-bit bimodal counters
+  uint32_t T0_idx;
+  tage_entry * entries; // the entries of T1..Tn
+  uint32_t total_entries;
+  tage_lanes<lanes> T;
+  int avx2; // look up with AVX2
+  int eager; // apply usefulness resets to every entry at once
+  uint32_t reset_period;
+
+  // usefulness resets: branches left until the next one, the parity of
+  // the last one, and the usefulness bits an entry needs to provide
+  // since then. Entries up to 'aged' have had the last reset applied,
+  // 'age_step' more every branch
+  uint32_t reset_countdown;
+  uint8_t epoch;
+  uint32_t provides_u;
+  uint32_t aged;
+  uint32_t age_step;
+
+  // the global history, a ring of outcomes with the newest at
+  // ghist[ghist_pos] and older ones after it. Outcomes are 32-bit
+  // words, so the gathers that read them are served from the stores
+  // that wrote them
+  std::vector<uint32_t> ghist;
+  uint32_t ghist_pos;
+  uint32_t ghist_mask;
+  uint32_t max_history;
+
+  // the sets and tags of the branches a batch has indexed ahead, in
+  // a ring
+  alignas(32) uint32_t ahead_slot[TAGE_AHEAD][lanes];
+  alignas(32) uint32_t ahead_tag[TAGE_AHEAD][lanes];
+  size_t stepped; // the record the last step() indexed, in ahead_slot[0]
+                  // until anything else moves the history
+
+  //final prediction
+  uint8_t pred;
+  //who is the provider
+  uint8_t provider;
+
+  // random choices of the allocating table. Each predictor draws from
+  // its own stream, seeded like std::rand(), so instances running side
+  // by side make the same choices as a predictor running alone
+  struct random_data rng = {};
+  char rng_state[128];
+
+  //debug variables
+  int dbg_provider[G::max_tables + 1] = {};
+  int dbg_allocated[G::max_tables + 1] = {};
+  int dbg_predict_taken = 0;
+  int dbg_predict_nottaken = 0;
+  int dbg_prediction_match = 0;
+};
+
 //
 // TODO: Add your own Branch Predictor data structures here
 //
-// gshare
-uint8_t *bht_gshare;
-uint64_t ghistory;
-
-//debug variables
-int dbg_t0_provider = 0;
-int dbg_t1_provider = 0;
-int dbg_t2_provider = 0;
-int dbg_t3_provider = 0;
-int dbg_t4_provider = 0;
-int dbg_t1_allocated = 0;
-int dbg_t2_allocated = 0;
-int dbg_t3_allocated = 0;
-int dbg_t4_allocated = 0;
-int dbg_predict_taken = 0;
-int dbg_predict_nottaken = 0;
-int dbg_prediction_match = 0;
+// one gshare predictor
+class GsharePredictor final : public PredictorBase<GsharePredictor>
+{
+public:
+  GsharePredictor(const predictor_config *cfg);
+  uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct) { return gshare_predict(pc); }
+  void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
+  {
+    if (condition)
+      train_gshare(pc, outcome);
+  }
+  void seed_history(const uint64_t *history) { ghistory = history[0]; }
+  void checkpoint(state_image &image)
+  {
+    image.field(bht_gshare.data(), bht_gshare.bytes());
+    image.field(&ghistory, sizeof(ghistory));
+  }
+  void predict_batch(const branch_batch &batch, uint64_t *branches, uint64_t *mispredictions, uint64_t *predictions);
+  size_t step(const branch_batch &batch, size_t i, uint64_t *branches, uint64_t *mispredictions);
 
-void dbg_prints()
+private:
+  void init_gshare();
+  uint8_t gshare_predict(uint32_t pc);
+  void train_gshare(uint32_t pc, uint8_t outcome);
+
+  int ghistoryBits;
+  counter_table<2> bht_gshare;
+  uint64_t ghistory;
+};
+
+template <class P>
+void PredictorBase<P>::predict_batch(const branch_batch &batch, uint64_t *branches, uint64_t *mispredictions, uint64_t *predictions)
+{
+  P *bp = static_cast<P *>(this);
+  uint64_t num_branches = 0;
+  uint64_t incorrect = 0;
+  if (predictions != NULL)
+  {
+    memset(predictions, 0, (batch.n + 63) / 64 * sizeof(uint64_t));
+  }
+  for (size_t i = 0; i < batch.n; i++)
+  {
+    uint32_t pc = batch.pc[i];
+    uint32_t target = batch.target[i];
+    uint32_t outcome = batch.outcome[i];
+    uint8_t flags = batch.flags[i];
+    uint32_t condition = (flags & TRACE_CONDITION) ? 1 : 0;
+    uint32_t direct = (flags & TRACE_DIRECT) ? 1 : 0;
+    if (condition)
+    {
+      uint32_t prediction = bp->predict(pc, target, direct);
+      num_branches++;
+      incorrect += (prediction != outcome);
+      if (predictions != NULL)
+      {
+        predictions[i / 64] |= (uint64_t)prediction << (i % 64);
+      }
+    }
+    bp->train(pc, target, outcome, condition, (flags & TRACE_CALL) ? 1 : 0, (flags & TRACE_RET) ? 1 : 0, direct);
+  }
+  *branches += num_branches;
+  *mispredictions += incorrect;
+}
+
+template <class P>
+size_t PredictorBase<P>::step(const branch_batch &batch, size_t i, uint64_t *branches, uint64_t *mispredictions)
+{
+  // there is nothing to prefetch, so a step is a single record
+  P *bp = static_cast<P *>(this);
+  uint32_t pc = batch.pc[i];
+  uint32_t target = batch.target[i];
+  uint32_t outcome = batch.outcome[i];
+  uint8_t flags = batch.flags[i];
+  uint32_t condition = (flags & TRACE_CONDITION) ? 1 : 0;
+  uint32_t direct = (flags & TRACE_DIRECT) ? 1 : 0;
+  if (condition)
+  {
+    (*branches)++;
+    *mispredictions += (bp->predict(pc, target, direct) != outcome);
+  }
+  bp->train(pc, target, outcome, condition, (flags & TRACE_CALL) ? 1 : 0, (flags & TRACE_RET) ? 1 : 0, direct);
+  return i + 1;
+}
+
+// Finds the first conditional branch of 'batch' from record 'i' on
+//
+// Returns its record, batch.n if there is none
+//
+static size_t next_condition(const branch_batch &batch, size_t i)
+{
+  while (i < batch.n && !(batch.flags[i] & TRACE_CONDITION))
+  {
+    i++;
+  }
+  return i;
+}
+
+// The predictor behind init_predictor() and make_prediction()
+static Predictor *defaultPredictor;
+
+template <class G>
+void TagePredictor<G>::dbg_prints()
 {
 	printf("\n======= TAGE DEBUG VARIABLES =======\n\n");
-	printf("Number of times T1 was allocated                 :    %d\n",dbg_t1_allocated);	
-	printf("Number of times T2 was allocated                 :    %d\n",dbg_t2_allocated);	
-	printf("Number of times T3 was allocated                 :    %d\n",dbg_t3_allocated);	
-	printf("Number of times T4 was allocated                 :    %d\n",dbg_t4_allocated);
-	printf("Number of times T0 was provider                 :    %d\n",dbg_t0_provider);	
-	printf("Number of times T1 was provider                 :    %d\n",dbg_t1_provider);	
-	printf("Number of times T2 was provider                 :    %d\n",dbg_t2_provider);	
-	printf("Number of times T3 was provider                 :    %d\n",dbg_t3_provider);	
-	printf("Number of times T4 was provider                 :    %d\n",dbg_t4_provider);
-	printf("Total Number of Predictions                     :    %d\n",dbg_t0_provider+dbg_t1_provider+dbg_t2_provider+dbg_t3_provider+dbg_t4_provider);
-//FIXME: Why is the total count coming out twice the number of branches?
+	for (int i = 1; i <= geo.tables; i++)
+		printf("Number of times T%d was allocated                 :    %d\n", i, dbg_allocated[i]);
+	int total = 0;
+	for (int i = 0; i <= geo.tables; i++)
+	{
+		printf("Number of times T%d was provider                 :    %d\n", i, dbg_provider[i]);
+		total += dbg_provider[i];
+	}
+	printf("Total Number of Predictions                     :    %d\n",total);
 	printf("Number of times TAKEN was predicted             :    %d\n",dbg_predict_taken);	
 	printf("Number of times NOT TAKEN was predicted         :    %d\n",dbg_predict_nottaken);	
 	printf("Number of times prediction matched the outcome  :    %d\n",dbg_prediction_match);	
@@ -134,307 +503,615 @@ void dbg_prints()
 
 // Initialize the predictor
 
+void StaticPredictor::predict_batch(const branch_batch &batch, uint64_t *branches, uint64_t *mispredictions, uint64_t *predictions)
+{
+  // every conditional branch is predicted taken
+  uint64_t num_branches = 0;
+  uint64_t nottaken = 0;
+  for (size_t i = 0; i < batch.n; i++)
+  {
+    uint32_t condition = (batch.flags[i] & TRACE_CONDITION) ? 1 : 0;
+    num_branches += condition;
+    nottaken += condition & (batch.outcome[i] ^ 1);
+  }
+  if (predictions != NULL)
+  {
+    for (size_t w = 0; w < (batch.n + 63) / 64; w++)
+    {
+      uint64_t bits = 0;
+      for (size_t i = w * 64; i < std::min(batch.n, w * 64 + 64); i++)
+      {
+        bits |= (uint64_t)((batch.flags[i] & TRACE_CONDITION) ? 1 : 0) << (i % 64);
+      }
+      predictions[w] = bits;
+    }
+  }
+  *branches += num_branches;
+  *mispredictions += nottaken;
+}
+
 //##################
 // gshare functions
 //##################
 
-void init_gshare()
+GsharePredictor::GsharePredictor(const predictor_config *cfg)
+{
+  ghistoryBits = cfg->ghistoryBits;
+  init_gshare();
+}
+
+void GsharePredictor::init_gshare()
 {
   // allocate memory for 2^ghistoryBits entries in BHT
   int bht_entries = 1 << ghistoryBits;
-  bht_gshare = (uint8_t *)malloc(bht_entries * sizeof(uint8_t));
-  int i = 0;
-  for (i = 0; i < bht_entries; i++)
-  {
-    bht_gshare[i] = WN;
-  }
+  bht_gshare.init(bht_entries, WN);
   ghistory = 0;
 }
 
-uint8_t gshare_predict(uint32_t pc)
+uint8_t GsharePredictor::gshare_predict(uint32_t pc)
 {
   // XOR the lower ghistoryBits of PC, GHR
   uint32_t bht_entries = 1 << ghistoryBits;
   uint32_t index =  (pc & (bht_entries - 1)) ^ (ghistory & (bht_entries - 1));
 
   // Return the prediction based on state
-  switch (bht_gshare[index])
-  {
-  case WN:
-    return NOTTAKEN;
-  case SN:
-    return NOTTAKEN;
-  case WT:
-    return TAKEN;
-  case ST:
-    return TAKEN;
-  default:
-    printf("Warning: Undefined state of entry in GSHARE BHT!\n");
-    return NOTTAKEN;
-  }
+  return (bht_gshare.get(index) >= WT) ? TAKEN : NOTTAKEN;
 }
 
-void train_gshare(uint32_t pc, uint8_t outcome)
+void GsharePredictor::train_gshare(uint32_t pc, uint8_t outcome)
 {
   // XOR the lower ghistoryBits of PC, GHR
   uint32_t bht_entries = 1 << ghistoryBits;
   uint32_t index =  (pc & (bht_entries - 1)) ^ (ghistory & (bht_entries - 1));
 
   // Update state of entry in BHT based on outcome
-  switch (bht_gshare[index])
-  {
-  case WN:
-    bht_gshare[index] = (outcome == TAKEN) ? WT : SN;
-    break;
-  case SN:
-    bht_gshare[index] = (outcome == TAKEN) ? WN : SN;
-    break;
-  case WT:
-    bht_gshare[index] = (outcome == TAKEN) ? ST : WN;
-    break;
-  case ST:
-    bht_gshare[index] = (outcome == TAKEN) ? ST : WT;
-    break;
-  default:
-    printf("Warning: Undefined state of entry in GSHARE BHT!\n");
-    break;
-  }
+  bht_gshare.update(index, outcome == TAKEN);
 
   // Update history register
   ghistory = ((ghistory << 1) | outcome);
 }
 
-void cleanup_gshare()
+// Conditional branches gshare handles per pass of predict_batch()
+#define GSHARE_BATCH 1024
+
+void GsharePredictor::predict_batch(const branch_batch &batch, uint64_t *branches, uint64_t *mispredictions, uint64_t *predictions)
+{
+  uint32_t mask = (1 << ghistoryBits) - 1;
+  uint32_t index[GSHARE_BATCH];
+  uint8_t outcome[GSHARE_BATCH];
+  uint32_t record[GSHARE_BATCH];
+  uint64_t incorrect = 0;
+
+  if (predictions != NULL)
+  {
+    memset(predictions, 0, (batch.n + 63) / 64 * sizeof(uint64_t));
+  }
+  size_t i = 0;
+  while (i < batch.n)
+  {
+    // the outcomes are known, so the history, and with it the index,
+    // of every conditional branch is worked out before touching the BHT
+    size_t m = 0;
+    for (; i < batch.n && m < GSHARE_BATCH; i++)
+    {
+      if (batch.flags[i] & TRACE_CONDITION)
+      {
+        index[m] = (batch.pc[i] ^ ghistory) & mask;
+        outcome[m] = batch.outcome[i];
+        record[m] = i;
+        ghistory = (ghistory << 1) | batch.outcome[i];
+        m++;
+      }
+    }
+
+    // then the 2-bit counters are read and updated in order, taken
+    // counting up and not taken down, each word prefetched 'lookahead'
+    // branches before
+    for (size_t j = 0; j < (size_t)lookahead && j < m; j++)
+    {
+      bht_gshare.prefetch(index[j]);
+    }
+    for (size_t j = 0; j < m; j++)
+    {
+      if (j + lookahead < m)
+      {
+        bht_gshare.prefetch(index[j + lookahead]);
+      }
+      uint8_t state = bht_gshare.update(index[j], outcome[j]);
+      uint8_t prediction = state >> 1;
+      incorrect += (prediction != outcome[j]);
+      if (predictions != NULL)
+      {
+        predictions[record[j] / 64] |= (uint64_t)prediction << (record[j] % 64);
+      }
+    }
+    *branches += m;
+  }
+  *mispredictions += incorrect;
+}
+
+size_t GsharePredictor::step(const branch_batch &batch, size_t i, uint64_t *branches, uint64_t *mispredictions)
 {
-  free(bht_gshare);
+  // gshare only sees conditional branches
+  uint32_t mask = (1 << ghistoryBits) - 1;
+  i = next_condition(batch, i);
+  if (i == batch.n)
+  {
+    return i;
+  }
+  uint8_t state = bht_gshare.update((batch.pc[i] ^ ghistory) & mask, batch.outcome[i]);
+  (*branches)++;
+  *mispredictions += ((state >> 1) != batch.outcome[i]);
+  ghistory = (ghistory << 1) | batch.outcome[i];
+
+  i = next_condition(batch, i + 1);
+  if (i < batch.n)
+  {
+    bht_gshare.prefetch((batch.pc[i] ^ ghistory) & mask);
+  }
+  return i;
 }
 
+void predict_gshares(const branch_batch &batch, const uint64_t *history, const predictor_config *cfg, int n,
+                     uint64_t *branches, uint64_t *mispredictions)
+{
+  std::vector<counter_table<2> > bht(n);
+  for (int c = 0; c < n; c++)
+  {
+    bht[c].init((size_t)1 << cfg[c].ghistoryBits, WN);
+  }
+  uint64_t ghistory = history != NULL ? history[0] : 0;
+  uint32_t hash[GSHARE_BATCH];
+  uint8_t outcome[GSHARE_BATCH];
+
+  size_t i = 0;
+  while (i < batch.n)
+  {
+    // the records are decoded, and the history and the hash of PC and
+    // history worked out, once for all the gshares
+    size_t m = 0;
+    for (; i < batch.n && m < GSHARE_BATCH; i++)
+    {
+      if (batch.flags[i] & TRACE_CONDITION)
+      {
+        hash[m] = batch.pc[i] ^ (uint32_t)ghistory;
+        outcome[m] = batch.outcome[i];
+        ghistory = (ghistory << 1) | batch.outcome[i];
+        m++;
+      }
+    }
+    *branches += m;
+
+    // then each gshare takes its low bits of the hashes as indices and
+    // runs over the whole chunk, while the chunk is in L1
+    for (int c = 0; c < n; c++)
+    {
+      uint32_t mask = (1u << cfg[c].ghistoryBits) - 1;
+      uint64_t incorrect = 0;
+      for (size_t j = 0; j < (size_t)lookahead && j < m; j++)
+      {
+        bht[c].prefetch(hash[j] & mask);
+      }
+      for (size_t j = 0; j < m; j++)
+      {
+        if (j + lookahead < m)
+        {
+          bht[c].prefetch(hash[j + lookahead] & mask);
+        }
+        uint8_t state = bht[c].update(hash[j] & mask, outcome[j]);
+        incorrect += ((state >> 1) != outcome[j]);
+      }
+      mispredictions[c] += incorrect;
+    }
+  }
+}
+
+
 
 //################
 // tage functions
 //################
 
-void init_tage()
+template <class G>
+TagePredictor<G>::TagePredictor(const predictor_config *cfg)
 {
-  ghistory = 0;
-  
-  //counter of how many branches have been predicted so far
-  //will be used in resetting the u values
-  tage_branch_count = 0;
-
-  int i; 
-
-  //Create tables T0, T1, T2, T3, T4
-  //T0 has a single column for 2-bit unsigned predictor
-  //Each of T1, T2, T3, T4 has columns for 3-bit signed predictor, 2-bit usefulness counter, valid
-  //FIXME: What do we need valid for?
-
-  // allocate memory for 2^L0 entries in T0
-  T0_pred = (int8_t*)malloc(T0_entries * sizeof(int8_t));
-  for(i=0; i<T0_entries; i++){
-    T0_pred[i] = WN; //initialize to WN which will switch most easily to taken
-  }  
-  
-  // allocate memory for 2^L1 entries in T1
-  T1_pred = (int8_t*)malloc(T1_entries * sizeof(int8_t));
-  for(i=0; i<T1_entries; i++){
-    T1_pred[i] = -1; //initialize to WN which will switch most easily to taken 
-  }  
-  T1_u = (uint8_t*)malloc(T1_entries * sizeof(uint8_t));
-  for(i=0; i<T1_entries; i++){
-    T1_u[i] = SNU; //initialize to strongly not useful as per TAGE paper
-  }  
-  T1_valid = (uint8_t*)malloc(T1_entries * sizeof(uint8_t));
-  for(i=0; i<T1_entries; i++){
-    T1_valid[i] = 0x0; //initialize to invalid
-  }
-  T1_tag = (uint8_t*)malloc(T1_entries * sizeof(uint8_t));
-  for(i=0; i<T1_entries; i++){
-    T1_tag[i] = 0xBC; //initialize to invalid
-  }   
-
-  // allocate memory for 2^L2 entries in T2
-  int T2_entries = 1 << L2;  
-  T2_pred = (int8_t*)malloc(T2_entries * sizeof(int8_t));
-  for(i=0; i<T2_entries; i++){
-    T2_pred[i] = -1; //initialize to WN which will switch most easily to taken 
-  }  
-  T2_u = (uint8_t*)malloc(T2_entries * sizeof(uint8_t));
-  for(i=0; i<T2_entries; i++){
-    T2_u[i] = SNU; //initialize to strongly not useful as per TAGE paper
-  }  
-  T2_valid = (uint8_t*)malloc(T2_entries * sizeof(uint8_t));
-  for(i=0; i<T2_entries; i++){
-    T2_valid[i] = 0x0; //initialize to invalid
-  }  
-  T2_tag = (uint8_t*)malloc(T2_entries * sizeof(uint8_t));
-  for(i=0; i<T2_entries; i++){
-    T2_tag[i] = 0xBC; //initialize to invalid
-  } 
-
-  // allocate memory for 2^L3 entries in T3
-  int T3_entries = 1 << L3;  
-  T3_pred = (int8_t*)malloc(T3_entries * sizeof(int8_t));
-  for(i=0; i<T3_entries; i++){
-    T3_pred[i] = -1; //initialize to WN which will switch most easily to taken 
-  }  
-  T3_u = (uint8_t*)malloc(T3_entries * sizeof(uint8_t));
-  for(i=0; i<T3_entries; i++){
-    T3_u[i] = SNU; //initialize to strongly not useful as per TAGE paper
-  }  
-  T3_valid = (uint8_t*)malloc(T3_entries * sizeof(uint8_t));
-  for(i=0; i<T3_entries; i++){
-    T3_valid[i] = 0x0; //initialize to invalid
-  }  
-  T3_tag = (uint8_t*)malloc(T3_entries * sizeof(uint8_t));
-  for(i=0; i<T3_entries; i++){
-    T3_tag[i] = 0xBC; //initialize to invalid
-  }
- 
-  // allocate memory for 2^L4 entries in T4
-  int T4_entries = 1 << L4;  
-  T4_pred = (int8_t*)malloc(T4_entries * sizeof(int8_t));
-  for(i=0; i<T4_entries; i++){
-    T4_pred[i] = -1; //initialize to WN which will switch most easily to taken 
-  }  
-  T4_u = (uint8_t*)malloc(T4_entries * sizeof(uint8_t));
-  for(i=0; i<T4_entries; i++){
-    T4_u[i] = SNU; //initialize to strongly not useful as per TAGE paper
-  }  
-  T4_valid = (uint8_t*)malloc(T4_entries * sizeof(uint8_t));
-  for(i=0; i<T4_entries; i++){
-    T4_valid[i] = 0x0; //initialize to invalid
-  } 
-  T4_tag = (uint8_t*)malloc(T4_entries * sizeof(uint8_t));
-  for(i=0; i<T4_entries; i++){
-    T4_tag[i] = 0xBC; //initialize to invalid
-  }  
-}
-
-void tage_walk(uint32_t pc, uint8_t& T0_idx, uint8_t& T1_idx,uint8_t& T2_idx,uint8_t& T3_idx,uint8_t& T4_idx, uint8_t& pred, uint8_t& provider, uint8_t& altpred)
-{
-  //first calculated the indexes for each of the tables
-  //note that for all tables except T0, the hash function is XOR
-
-  T0_idx = pc & (T0_entries - 1); 
-  T1_idx = (pc & (T1_entries - 1)) ^ (ghistory & (T1_entries - 1)); 
-  T2_idx = (pc & (T2_entries - 1)) ^ (ghistory & (T2_entries - 1)); 
-  T3_idx = (pc & (T3_entries - 1)) ^ (ghistory & (T3_entries - 1)); 
-  T4_idx = (pc & (T4_entries - 1)) ^ (ghistory & (T4_entries - 1)); 
-
-
-  uint8_t default_pred; 
-  switch (T0_pred[T0_idx])
-  {
-  case WN:
-    default_pred = NOTTAKEN;
-	break;
-  case SN:
-    default_pred = NOTTAKEN;
-	break;
-  case WT:
-    default_pred = TAKEN;
-	break;
-  case ST:
-    default_pred = TAKEN;
-	break;
-  default:
-    printf("Warning: Undefined state of entry in table T0 !\n");
-    default_pred = NOTTAKEN;
-    break;
+  geo.configure(cfg);
+  reset_period = cfg->resetPeriod;
+  initstate_r(1, rng_state, sizeof(rng_state), &rng);
+  avx2 = tageLookup == TAGE_LOOKUP_AVX2 ||
+         (tageLookup == TAGE_LOOKUP_AUTO && __builtin_cpu_supports("avx2"));
+  eager = tageAging == TAGE_AGING_EAGER;
+
+  reset_countdown = reset_period;
+  epoch = 0;
+  provides_u = WU;
+
+  // T0 has a single column for 2-bit unsigned predictor
+  T0.init(1 << geo.bits[0], WN); //initialize to WN which will switch most easily to taken
+
+  // each entry of T1..Tn has a 3-bit signed predictor, a 2-bit
+  // usefulness counter and a tag. The tables follow each other in
+  // 'entries', each starting on a cache line
+  memset(&T, 0, sizeof(T));
+  total_entries = 0;
+  max_history = 0;
+  for (int t = 1; t <= geo.tables; t++)
+  {
+    int lane = t - 1;
+    T.base[lane] = total_entries;
+    T.index_mask[lane] = (1u << geo.fold_width(t, FOLD_INDEX)) - 1;
+    T.tag_mask[lane] = (1u << geo.tag_bits[t]) - 1;
+    T.history[lane] = geo.history[t];
+    for (int k = 0; k < 3; k++)
+    {
+      T.width[k][lane] = geo.fold_width(t, k);
+      T.fold_mask[k][lane] = (1u << geo.fold_width(t, k)) - 1;
+      T.outpoint[k][lane] = geo.fold_outpoint(t, k);
+    }
+    total_entries += std::max<uint32_t>(1u << geo.bits[t], TAGE_LINE / sizeof(tage_entry));
+    max_history = std::max(max_history, geo.history[t]);
+  }
+  // one line more, as the ways of the last set are matched a whole
+  // vector at a time
+  entries = (tage_entry*)aligned_alloc(TAGE_LINE, total_entries * sizeof(tage_entry) + TAGE_LINE);
+  for (uint32_t i = 0; i < total_entries + TAGE_LINE / sizeof(tage_entry); i++)
+  {
+    entries[i].pred = -1;  //initialize to WN which will switch most easily to taken
+    entries[i].u = SNU;    //initialize to strongly not useful as per TAGE paper
+    entries[i].tag = 0xBC; //initialize to invalid
   }
 
-  //predictions from T1-T4 using 2 bits after index as tag
-/*
-  uint8_t t1_pred = T1_valid[T1_idx] && (T1_tag[T1_idx] == ((pc >> (T1_entries - 1)) & tag_mask)) ? ( (T1_pred[T1_idx]>=0) ? TAKEN : NOTTAKEN ) : INVALID; 
-  uint8_t t2_pred = T2_valid[T2_idx] && (T2_tag[T2_idx] == ((pc >> (T2_entries - 1)) & tag_mask)) ? ( (T2_pred[T2_idx]>=0) ? TAKEN : NOTTAKEN ) : INVALID; 
-  uint8_t t3_pred = T3_valid[T3_idx] && (T3_tag[T3_idx] == ((pc >> (T3_entries - 1)) & tag_mask)) ? ( (T3_pred[T3_idx]>=0) ? TAKEN : NOTTAKEN ) : INVALID; 
-  uint8_t t4_pred = T4_valid[T4_idx] && (T4_tag[T4_idx] == ((pc >> (T4_entries - 1)) & tag_mask)) ? ( (T4_pred[T4_idx]>=0) ? TAKEN : NOTTAKEN ) : INVALID; 
-*/
- 
-  //predictions from T1-T4 using lower 2 bits as tag
-  uint8_t t1_pred = (T1_u[T1_idx]==SNU||T1_u[T1_idx]==WNU) ? INVALID : ((T1_tag[T1_idx] == (pc & tag_mask)) ? ( (T1_pred[T1_idx]>=0) ? TAKEN : NOTTAKEN ) : INVALID); 
-  uint8_t t2_pred = (T2_u[T2_idx]==SNU||T2_u[T2_idx]==WNU) ? INVALID : ((T2_tag[T2_idx] == (pc & tag_mask)) ? ( (T2_pred[T2_idx]>=0) ? TAKEN : NOTTAKEN ) : INVALID); 
-  uint8_t t3_pred = (T3_u[T3_idx]==SNU||T3_u[T3_idx]==WNU) ? INVALID : ((T3_tag[T3_idx] == (pc & tag_mask)) ? ( (T3_pred[T3_idx]>=0) ? TAKEN : NOTTAKEN ) : INVALID); 
-  uint8_t t4_pred = (T4_u[T4_idx]==SNU||T4_u[T4_idx]==WNU) ? INVALID : ((T4_tag[T4_idx] == (pc & tag_mask)) ? ( (T4_pred[T4_idx]>=0) ? TAKEN : NOTTAKEN ) : INVALID);  
+  // a reset is applied to every entry, a line at a time, before the
+  // next one comes
+  aged = total_entries;
+  age_step = (total_entries + reset_period - 1) / reset_period;
+  age_step = (age_step + TAGE_LINE / sizeof(tage_entry) - 1) & ~(TAGE_LINE / sizeof(tage_entry) - 1);
 
-  provider = 0xBC; 
+  // the ring keeps the outcome 'max_history' branches old, which is the
+  // one dropping out of the longest folded history
+  uint32_t ring = 1;
+  while (ring <= max_history)
+  {
+    ring <<= 1;
+  }
+  ghist.assign(ring, 0);
+  ghist_mask = ring - 1;
+  ghist_pos = 0;
+  stepped = SIZE_MAX;
+}
 
-  int provider_found = 0;
-  
-  //choose the prediction with the longest branch history 
-  if(t4_pred != INVALID)
+template <class G>
+TagePredictor<G>::~TagePredictor()
+{
+  free(entries);
+}
+
+template <class G>
+int TagePredictor<G>::tage_rand()
+{
+  int32_t value;
+  random_r(&rng, &value);
+  return value;
+}
+
+// fold_history() for eight tables at a time
+template <int LANES>
+__attribute__((target("avx2")))
+static void fold_histories_avx2(tage_lanes<LANES> &T, const uint32_t *ghist, uint32_t pos, uint32_t ring_mask, uint8_t outcome)
+{
+  const __m256i in = _mm256_set1_epi32(outcome);
+  const __m256i one = _mm256_set1_epi32(1);
+  for (int v = 0; v < LANES; v += 8)
   {
-    pred = t4_pred; 
-    provider = 4; 
-	dbg_t4_provider++;   
-    provider_found = 1;
+    __m256i age = _mm256_add_epi32(_mm256_set1_epi32(pos), _mm256_load_si256((const __m256i *)(T.history + v)));
+    age = _mm256_and_si256(age, _mm256_set1_epi32(ring_mask));
+    __m256i out = _mm256_and_si256(_mm256_i32gather_epi32((const int *)ghist, age, 4), one);
+    for (int k = 0; k < 3; k++)
+    {
+      __m256i *fold = (__m256i *)(T.fold[k] + v);
+      __m256i value = _mm256_or_si256(_mm256_slli_epi32(_mm256_load_si256(fold), 1), in);
+      value = _mm256_xor_si256(value, _mm256_sllv_epi32(out, _mm256_load_si256((const __m256i *)(T.outpoint[k] + v))));
+      value = _mm256_xor_si256(value, _mm256_srlv_epi32(value, _mm256_load_si256((const __m256i *)(T.width[k] + v))));
+      _mm256_store_si256(fold, _mm256_and_si256(value, _mm256_load_si256((const __m256i *)(T.fold_mask[k] + v))));
+    }
   }
-  else if(!provider_found && t3_pred != INVALID)
+}
+
+template <class G>
+void TagePredictor<G>::push_history(uint8_t outcome)
+{
+  ghist_pos = (ghist_pos - 1) & ghist_mask;
+  ghist[ghist_pos] = outcome;
+  if (avx2)
   {
-    pred = t3_pred;
-    provider = 3;    
-	dbg_t3_provider++;   
-    provider_found = 1;
+    fold_histories_avx2(T, ghist.data(), ghist_pos, ghist_mask, outcome);
+    return;
   }
-  else if(!provider_found && t2_pred != INVALID)
+#pragma GCC unroll 16
+  for (int t = 1; t <= geo.tables; t++)
   {
-    pred = t2_pred;
-    provider = 2;    
-	dbg_t2_provider++;   
-    provider_found = 1;
+    uint8_t out = ghist[(ghist_pos + geo.history[t]) & ghist_mask];
+#pragma GCC unroll 3
+    for (int k = 0; k < 3; k++)
+    {
+      T.fold[k][t - 1] = fold_history(T.fold[k][t - 1], outcome, out, geo.fold_width(t, k), geo.fold_outpoint(t, k));
+    }
   }
-  else if(!provider_found && t1_pred != INVALID)
+}
+
+template <class G>
+void TagePredictor<G>::seed_history(const uint64_t *history)
+{
+  // replay the snapshot from an empty history, oldest outcome first
+  stepped = SIZE_MAX;
+  std::fill(ghist.begin(), ghist.end(), 0);
+  memset(T.fold, 0, sizeof(T.fold));
+  for (int age = max_history - 1; age >= 0; age--)
   {
-    pred = t1_pred;
-    provider = 1;    
-	dbg_t1_provider++;   
-    provider_found = 1;
+    push_history((history[age / 64] >> (age % 64)) & 1);
   }
-  else
+}
+
+template <class G>
+void TagePredictor<G>::checkpoint(state_image &image)
+{
+  // the geometry and whatever follows from it come from the config,
+  // the sets and tags looked up ahead are indexed again
+  stepped = SIZE_MAX;
+  image.field(T0.data(), T0.bytes());
+  image.field(entries, (total_entries + TAGE_LINE / sizeof(tage_entry)) * sizeof(tage_entry));
+  image.field(T.fold, sizeof(T.fold));
+  image.field(ghist.data(), ghist.size() * sizeof(uint32_t));
+  image.field(&ghist_pos, sizeof(ghist_pos));
+  image.field(&reset_countdown, sizeof(reset_countdown));
+  image.field(&epoch, sizeof(epoch));
+  image.field(&provides_u, sizeof(provides_u));
+  image.field(&aged, sizeof(aged));
+
+  // the random stream is its state array and two positions in it
+  int32_t rng_pos[2] = {(int32_t)(rng.fptr - rng.state), (int32_t)(rng.rptr - rng.state)};
+  image.field(rng_state, sizeof(rng_state));
+  image.field(rng_pos, sizeof(rng_pos));
+  rng.fptr = rng.state + rng_pos[0];
+  rng.rptr = rng.state + rng_pos[1];
+
+  image.field(dbg_provider, sizeof(dbg_provider));
+  image.field(dbg_allocated, sizeof(dbg_allocated));
+  image.field(&dbg_predict_taken, sizeof(dbg_predict_taken));
+  image.field(&dbg_predict_nottaken, sizeof(dbg_predict_nottaken));
+  image.field(&dbg_prediction_match, sizeof(dbg_prediction_match));
+}
+
+// Matches the 'ways' entries of the set at 'set' against 'tag', eight
+// ways per instruction. An entry provides when its usefulness has all
+// the bits of 'need'
+//
+// Returns a bit per way that could provide
+//
+__attribute__((target("avx2")))
+static uint32_t match_set_avx2(const tage_entry *set, uint32_t ways, uint32_t tag, uint32_t need)
+{
+  const __m256i provides = _mm256_set1_epi32(0x0000ffff | (need << 24));
+  const __m256i key = _mm256_set1_epi32(tag | (need << 24));
+  uint32_t hits = 0;
+  for (uint32_t w = 0; w < ways; w += 8)
   {
-    pred = default_pred; 
-    provider = 0;    
-	dbg_t0_provider++;   
-    provider_found = 1;
+    __m256i e = _mm256_loadu_si256((const __m256i *)(set + w));
+    __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(e, provides), key);
+    hits |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(hit)) << w;
   }
+  return hits & ((1u << ways) - 1);
+}
 
-  //altpred computation
-  altpred = 0;
-  if(provider == 4)
+static uint32_t match_set(const tage_entry *set, uint32_t ways, uint32_t tag, uint32_t need)
+{
+  uint32_t hits = 0;
+  for (uint32_t w = 0; w < ways; w++)
   {
-    if(t3_pred != INVALID) 
-      altpred = 3;
-    else
-    if(t2_pred != INVALID)
-      altpred = 2;
-    else
-    if(t1_pred != INVALID)
-      altpred = 1;
+    hits |= (uint32_t)((set[w].u & need) == need && set[w].tag == tag) << w;
   }
-  else
-  if(provider == 3)
+  return hits;
+}
+
+// Works out the sets and tags of the branch at 'pc' in tables v..v+7,
+// from the folds of the history
+template <int LANES>
+__attribute__((target("avx2")))
+static inline void index_tables_avx2(const tage_lanes<LANES> &T, int v, uint32_t pc, uint32_t way_bits, __m256i &slot, __m256i &tag)
+{
+  const __m256i vpc = _mm256_set1_epi32(pc);
+  __m256i idx = _mm256_xor_si256(vpc, _mm256_load_si256((const __m256i *)(T.fold[FOLD_INDEX] + v)));
+  idx = _mm256_and_si256(idx, _mm256_load_si256((const __m256i *)(T.index_mask + v)));
+  idx = _mm256_sll_epi32(idx, _mm_cvtsi32_si128(way_bits));
+  slot = _mm256_add_epi32(idx, _mm256_load_si256((const __m256i *)(T.base + v)));
+  tag = _mm256_xor_si256(vpc, _mm256_load_si256((const __m256i *)(T.fold[FOLD_TAG] + v)));
+  tag = _mm256_xor_si256(tag, _mm256_slli_epi32(_mm256_load_si256((const __m256i *)(T.fold[FOLD_TAG2] + v)), 1));
+  tag = _mm256_and_si256(tag, _mm256_load_si256((const __m256i *)(T.tag_mask + v)));
+}
+
+// index_tables_avx2() for every table, into 'slot' and 'tag'
+template <int LANES>
+__attribute__((target("avx2")))
+static void tage_index_avx2(const tage_lanes<LANES> &T, uint32_t pc, uint32_t way_bits, uint32_t *slot, uint32_t *tag)
+{
+  for (int v = 0; v < LANES; v += 8)
   {
-    if(t2_pred != INVALID)
-      altpred = 2;
+    __m256i s, t;
+    index_tables_avx2(T, v, pc, way_bits, s, t);
+    _mm256_store_si256((__m256i *)(slot + v), s);
+    _mm256_store_si256((__m256i *)(tag + v), t);
+  }
+}
+
+// Looks up the branch at 'pc' in eight tables at a time: their indices
+// and tags are computed side by side, their entries gathered and
+// compared with one instruction. The sets of set-associative tables
+// are matched one table at a time instead. The sets and tags are taken
+// from 'sets' and 'tags' when they are not NULL
+//
+// Returns a bit per table, set for the tables that could provide
+//
+template <int LANES>
+__attribute__((target("avx2")))
+static uint32_t tage_lookup_avx2(tage_lanes<LANES> &T, const tage_entry *entries, uint32_t pc, int tables, uint32_t way_bits, uint32_t need,
+                                 const uint32_t *sets, const uint32_t *tags)
+{
+  // an entry provides when its tag matches and its usefulness has the
+  // bits of 'need'
+  const __m256i provides = _mm256_set1_epi32(0x0000ffff | (need << 24));
+  uint32_t hits = 0;
+  for (int v = 0; v < LANES; v += 8)
+  {
+    __m256i slot, tag;
+    if (sets != NULL)
+    {
+      slot = _mm256_load_si256((const __m256i *)(sets + v));
+      tag = _mm256_load_si256((const __m256i *)(tags + v));
+    }
     else
-    if(t1_pred != INVALID)
-      altpred = 1;
+    {
+      index_tables_avx2(T, v, pc, way_bits, slot, tag);
+    }
+    _mm256_store_si256((__m256i *)(T.slot + v), slot);
+    _mm256_store_si256((__m256i *)(T.branch_tag + v), tag);
+    if (way_bits)
+    {
+      continue;
+    }
+
+    __m256i e = _mm256_i32gather_epi32((const int *)entries, slot, sizeof(tage_entry));
+    __m256i hit = _mm256_cmpeq_epi32(_mm256_and_si256(e, provides), _mm256_or_si256(tag, _mm256_set1_epi32(need << 24)));
+    hits |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(hit)) << v;
+  }
+  if (way_bits == 0)
+  {
+    return hits & ((1u << tables) - 1);
+  }
+
+  // a table hits when any way of its set does, and its slot becomes
+  // the way that hit
+  uint32_t ways = 1u << way_bits;
+  for (int lane = 0; lane < tables; lane++)
+  {
+    uint32_t way_hits = match_set_avx2(entries + T.slot[lane], ways, T.branch_tag[lane], need);
+    T.slot[lane] += way_hits ? __builtin_ctz(way_hits) : 0;
+    hits |= (uint32_t)(way_hits != 0) << lane;
+  }
+  return hits;
+}
+
+// Picks the entry of the set at 'set' that a new entry tagged 'tag'
+// replaces: the way already holding the tag, so a branch never has two
+// entries in a set, otherwise the least useful way, the first one on a
+// tie. 'epoch' is the parity of the last usefulness reset
+//
+// Returns the entry
+//
+static uint32_t choose_victim(const tage_entry *entries, uint32_t set, uint32_t ways, uint16_t tag, uint8_t epoch)
+{
+  uint32_t victim = set;
+  uint8_t least = 0xff;
+  for (uint32_t w = set; w < set + ways; w++)
+  {
+    if (entries[w].tag == tag)
+    {
+      return w;
+    }
+    uint8_t u = age_usefulness(entries[w].u, epoch) & 0x03;
+    if (u < least)
+    {
+      victim = w;
+      least = u;
+    }
+  }
+  return victim;
+}
+
+// Works out the set of every table the branch at 'pc' maps to, and its
+// tag in each, into 'slot' and 'tag'
+template <class G>
+void TagePredictor<G>::tage_index(uint32_t pc, uint32_t *slot, uint32_t *tag)
+{
+  if (avx2)
+  {
+    tage_index_avx2(T, pc, geo.way_bits, slot, tag);
+    return;
+  }
+
+  //the index of each tagged table XORs the PC with its folded history,
+  //the tag XORs it with two more foldings
+#pragma GCC unroll 16
+  for (int t = 1; t <= geo.tables; t++)
+  {
+    int lane = t - 1;
+    uint32_t idx = (pc ^ T.fold[FOLD_INDEX][lane]) & ((1u << geo.fold_width(t, FOLD_INDEX)) - 1);
+    slot[lane] = T.base[lane] + (idx << geo.way_bits);
+    tag[lane] = (pc ^ T.fold[FOLD_TAG][lane] ^ (T.fold[FOLD_TAG2][lane] << 1)) & ((1u << geo.tag_bits[t]) - 1);
+  }
+}
+
+// Looks the branch at 'pc' up in T1..Tn, in the sets and with the tags
+// in 'slot' and 'tag' when they were worked out ahead, and are not NULL
+//
+// Returns a bit per table, set for the tables that could provide
+//
+template <class G>
+uint32_t TagePredictor<G>::tage_lookup(uint32_t pc, const uint32_t *slot, const uint32_t *tag)
+{
+  if (avx2)
+  {
+    return tage_lookup_avx2(T, entries, pc, geo.tables, geo.way_bits, provides_u, slot, tag);
+  }
+  if (slot != NULL)
+  {
+    memcpy(T.slot, slot, sizeof(T.slot));
+    memcpy(T.branch_tag, tag, sizeof(T.branch_tag));
   }
   else
-  if(provider == 2)
   {
-    if(t1_pred != INVALID)
-      altpred = 1;
+    tage_index(pc, T.slot, T.branch_tag);
+  }
+
+  //with ways, a table hits when any way of its set does, and its slot
+  //becomes the way that hit
+  uint32_t hits = 0;
+#pragma GCC unroll 16
+  for (int t = 1; t <= geo.tables; t++)
+  {
+    int lane = t - 1;
+    uint32_t way_hits = match_set(entries + T.slot[lane], 1u << geo.way_bits, T.branch_tag[lane], provides_u);
+    T.slot[lane] += way_hits ? __builtin_ctz(way_hits) : 0;
+    hits |= (uint32_t)(way_hits != 0) << lane;
+  }
+  return hits;
+}
+
+template <class G>
+void TagePredictor<G>::tage_walk(uint32_t pc, const uint32_t *slot, const uint32_t *tag)
+{
+  T0_idx = pc & ((1u << geo.bits[0]) - 1);
+
+  //choose the prediction with the longest branch history: the
+  //highest table that hit, 0 for none
+  uint32_t hits = tage_lookup(pc, slot, tag);
+  provider = 31 - __builtin_clz((hits << 1) | 1);
+
+  if (provider)
+  {
+    pred = (entries[T.slot[provider - 1]].pred >= 0) ? TAKEN : NOTTAKEN;
   }
   else
-    altpred = 0;
+  {
+    pred = (T0.get(T0_idx) >= WT) ? TAKEN : NOTTAKEN;
+  }
+  dbg_provider[provider]++;
 }
 
-uint8_t tage_predict(uint32_t pc)
+template <class G>
+uint8_t TagePredictor<G>::tage_predict(uint32_t pc, const uint32_t *slot, const uint32_t *tag)
 {
 
-  tage_walk(pc, T0_idx, T1_idx, T2_idx, T3_idx, T4_idx, pred, provider, altpred);
+  tage_walk(pc, slot, tag);
 
   if(pred == TAKEN)
     dbg_predict_taken++;
@@ -446,7 +1123,7 @@ uint8_t tage_predict(uint32_t pc)
   
 }
 
-void update_usefulness(int pred_correct ,uint8_t & u )
+static void update_usefulness(int pred_correct ,uint8_t & u )
 {
   //if the prediction was correct, the usefulness counter is incremented. Else, it is decremented
   if(pred_correct)
@@ -493,302 +1170,250 @@ void update_usefulness(int pred_correct ,uint8_t & u )
   }
 }
 
-void periodic_usefulness_reset()
+// age_usefulness() for the entries from 'begin' to 'end', a multiple
+// of eight apart, eight at a time
+__attribute__((target("avx2")))
+static void age_entries_avx2(tage_entry *entries, uint32_t begin, uint32_t end, uint8_t epoch)
 {
- 	tage_branch_count++;
-    int even_cycle = 0; //reset MSBs
-	int odd_cycle = 0; //reset LSBs
-    uint8_t usefulness_mask = 0x03;
-    if(tage_branch_count % TAGE_RESET_PERIOD == 0)
-	{
-		if(tage_branch_count % (2*TAGE_RESET_PERIOD)) 
-			{
-			even_cycle = 1;
-			usefulness_mask = 0x01;
-			}
-		else
-			{
-			odd_cycle = 1;
-			usefulness_mask = 0x02;
-			}
-		//iterate over all usefulness values and apply the mask
-		int i;
-
-  		for(i=0; i<T1_entries; i++){
-  		  T1_u[i] = T1_u[i] & usefulness_mask;
-  		}  
-  		for(i=0; i<T2_entries; i++){
-  		  T2_u[i] = T2_u[i] & usefulness_mask;
-  		}  
-  		for(i=0; i<T3_entries; i++){
-  		  T3_u[i] = T3_u[i] & usefulness_mask;
-  		}  
-  		for(i=0; i<T4_entries; i++){
-  		  T4_u[i] = T4_u[i] & usefulness_mask;
-  		}  
-	} 	
-}
-
-//function to update the prediction counter of an entry in T1,...,T4
-void update_pred(uint8_t outcome, int8_t & entry )
+  // a stale entry has its stamp differ from 'epoch', and loses the
+  // usefulness bit the reset clears. Every entry loses its stamp, and
+  // takes 'epoch' as its new one
+  const __m256i stamp = _mm256_set1_epi32(TAGE_EPOCH << 24);
+  const __m256i now = _mm256_set1_epi32(epoch << 24);
+  const __m256i clear = _mm256_set1_epi32((epoch ? 0x02 : 0x01) << 24);
+  for (uint32_t i = begin; i < end; i += 8)
+  {
+    __m256i e = _mm256_load_si256((const __m256i *)(entries + i));
+    __m256i fresh = _mm256_cmpeq_epi32(_mm256_and_si256(e, stamp), now);
+    e = _mm256_andnot_si256(_mm256_or_si256(stamp, _mm256_andnot_si256(fresh, clear)), e);
+    _mm256_store_si256((__m256i *)(entries + i), _mm256_or_si256(e, now));
+  }
+}
+
+// Counts a branch towards the next usefulness reset, and applies the
+// last reset to the next 'age_step' entries. A reset alternately
+// clears the MSBs and the LSBs of all usefulness values, but only
+// flips the epoch when it comes; until an entry is aged it provides
+// only when its MSB has outlived the reset
+template <class G>
+void TagePredictor<G>::age_entries()
+{
+  if (--reset_countdown == 0)
+  {
+    reset_countdown = reset_period;
+    epoch ^= TAGE_EPOCH;
+    provides_u = WU | epoch;
+    aged = 0;
+    if (eager)
+    {
+      // the reference: the reset clears its bit of every entry now
+      uint8_t keep = epoch ? 0x01 : 0x02;
+      for (uint32_t i = 0; i < total_entries; i++)
+      {
+        entries[i].u = (entries[i].u & keep) | epoch;
+      }
+      aged = total_entries;
+    }
+  }
+
+  if (aged == total_entries)
+  {
+    return;
+  }
+  uint32_t end = std::min(aged + age_step, total_entries);
+  if (avx2)
+  {
+    age_entries_avx2(entries, aged, end, epoch);
+  }
+  else
+  {
+    for (uint32_t i = aged; i < end; i++)
+    {
+      entries[i].u = age_usefulness(entries[i].u, epoch);
+    }
+  }
+  aged = end;
+}
+
+//function to update the prediction counter of an entry in T1,...,Tn
+static void update_pred(uint8_t outcome, int8_t & entry )
 {
 	entry = (outcome == TAKEN) ? std::max<int8_t>(entry+1, 3) : std::min<int8_t>(entry-1, -4); 
 }
 
-void train_tage(uint32_t pc, uint8_t outcome)
+// Picks the table to allocate an entry in after a misprediction, one
+// with a longer history than the provider's. The longest is twice as
+// likely as the next longest, and so on down to the provider
+//
+// Returns the table
+//
+template <class G>
+int TagePredictor<G>::choose_allocation()
 {
+  int candidates = geo.tables - provider;
+  int allocation = geo.tables;
+  if (candidates > 1)
+  {
+    uint32_t r = tage_rand() % ((1u << candidates) - 1);
+    uint32_t weight = 1u << (candidates - 1);
+    while (r >= weight)
+    {
+      r -= weight;
+      weight >>= 1;
+      allocation--;
+    }
+  }
+  return allocation;
+}
 
-  //update usefulness
+template <class G>
+void TagePredictor<G>::train_tage(uint32_t pc, uint8_t outcome)
+{
+  //update usefulness of the provider
   int pred_correct = (pred == outcome) ? 1 : 0;
-  switch(provider)
-  {
-    case 0:
-      //NOP
-	  break;
-    case 1:
-      update_usefulness(pred_correct, T1_u[T1_idx]);
-	  break;
-    case 2:
-      update_usefulness(pred_correct, T2_u[T2_idx]);
-	  break;
-    case 3:
-      update_usefulness(pred_correct, T3_u[T3_idx]);
-	  break;
-    case 4:
-      update_usefulness(pred_correct, T3_u[T3_idx]);
-	  break;
-  	default:
-  	  printf("Warning: Undefined state of provider in TAGE !\n");
-  	  break;
-  }
- 
-  //update prediction counter on correct prediction
-  if(pred_correct)
+  if (provider)
+  {
+    tage_entry &e = entries[T.slot[provider - 1]];
+    uint8_t u = age_usefulness(e.u, epoch) & 0x03;
+    update_usefulness(pred_correct, u);
+    e.u = u | epoch;
+  }
+
+  //update the provider ctr
+  if (provider)
+  {
+    update_pred(outcome, entries[T.slot[provider - 1]].pred); //these are signed 3 bit counters
+  }
+  else
+  {
+    // T0 has 2-bit predictors: a correct prediction strengthens its
+    // counter, a wrong one moves it towards the outcome
+    T0.update(T0_idx, outcome == TAKEN);
+  }
+
+  if (pred_correct)
   {
     dbg_prediction_match++;
-  	switch(provider)
-  	{
-      // T0 has 2-bit predictors
-  	  case 0:
-  	    {
-  	      switch(T0_pred[T0_idx])
-  	      {
-		  //these updates are in the case when the prediction matched the outcome
-  	  	  case WN:
-  	  		T0_pred[T0_idx] = SN;
-	  		break;
-  	  	  case SN:
-  	  		//NOP
-	  		break;
-  	  	  case WT:
-  	  		T0_pred[T0_idx] = ST;
-	  		break;
-  	      case ST:
-  	  		//NOP
-	  		break;
-  	      default:
-  	        printf("Warning: undefined state of entry in table T0 during training");
-	  		break;
-  	      }
-		break;
-  	    }
-      // T1, T2, T3, T4 have signed 3 bit counters
-  	  case 1:
-  	    update_pred(outcome, T1_pred[T1_idx]); //these are signed 3 bit counters
-	  	break;
-  	  case 2:
-  	    update_pred(outcome, T2_pred[T2_idx]); //these are signed 3 bit counters
-	  	break;
-  	  case 3:
-  	    update_pred(outcome, T3_pred[T3_idx]); //these are signed 3 bit counters
-	  	break;
-  	  case 4:
-  	    update_pred(outcome, T4_pred[T4_idx]); //these are signed 3 bit counters
-	  	break;
-  	  default:
-  	    printf("Warning: Undefined state of provider in TAGE !\n");
-  	    break; 
-  	}
-  } 
-
-  //updates if overall prediction is incorrect
-  else 
-  {
-    //update the provider ctr 
-  	switch(provider)
-  	{
-      // T0 has 2-bit predictors
-  	  case 0:
-  	    {
-  	      switch(T0_pred[T0_idx])
-  	      {
-		  //these updates are in the case when the prediction did not match the outcome
-  	  	  case WN:
-  	  		T0_pred[T0_idx] = WT;
-			break;
-  	  	  case SN:
-  	  		T0_pred[T0_idx] = WN;
-			break;
-  	  	  case WT:
-  	  		T0_pred[T0_idx] = WN;
-			break;
-  	      case ST:
-  	  	    T0_pred[T0_idx] = WT;
-		    break;
-  	      default:
-  	        printf("Warning: undefined state of entry in table T0 during training");
-		    break;
-  	      }
-  		break;
-  	    }
-      // T1, T2, T3, T4 have signed 3 bit counters
-  	  case 1:
-  	    update_pred(outcome, T1_pred[T1_idx]); //these are signed 3 bit counters
-  		break;
-  	  case 2:
-  	    update_pred(outcome, T2_pred[T2_idx]); //these are signed 3 bit counters
-  		break;
-  	  case 3:
-  	    update_pred(outcome, T3_pred[T3_idx]); //these are signed 3 bit counters
-  		break;
-  	  case 4:
-  	    update_pred(outcome, T4_pred[T4_idx]); //these are signed 3 bit counters
-  		break;
-  	  default:
-  	    printf("Warning: Undefined state of provider in TAGE !\n");
-  	    break; 
-  	}
-
-    //if the provider was NOT the component with the longest history (i.e. T4 in our case),
-    if (provider != 4)
-    {
-    	//allocate a new entry with a longer history
-	    //pick Tj or Tk randomly, with Tj having twice the probability of Tk, j<k
-		int allocation;
-		int random_value; 
-
-		switch(provider)
-		{
-			case 3:
-				{
-					allocation = 4;
-					dbg_t4_allocated++;
-					break;
-				}
-			case 2:
-				{
-					random_value = std::rand() % 4;
-					if(random_value<2)
-						{
-						allocation = 3;
-						dbg_t3_allocated++;
-						}
-					else
-						{
-						allocation = 4;
-						dbg_t4_allocated++;
-						}
-					break;
-				}
-			case 1:
-				{
-					random_value = std::rand() % 7;
-					if(random_value<4)
-						{
-						allocation = 4;
-						dbg_t4_allocated++;
-						}
-					else if(random_value<6)
-						{
-						allocation = 3;
-						dbg_t3_allocated++;
-						}
-					else
-						{
-						allocation = 1;
-						dbg_t1_allocated++;
-						}
-					break;
-				}
-			case 0:
-				{
-					random_value = std::rand() % 15;
-					if(random_value<8)
-						{
-						allocation = 4;
-						dbg_t4_allocated++;
-						}
-					else if (8<=random_value & random_value<12)
-						{
-						allocation = 2;
-						dbg_t2_allocated++;
-						}
-					else if (12<=random_value & random_value<14)
-						{
-						allocation = 3;
-						dbg_t3_allocated++;
-						}
-					else if (random_value==14)
-						{
-						allocation = 1;
-						dbg_t1_allocated++;
-						}
-				}
-		}
-				
-	
-		//initialize the newly allocated entry
-		//FIXME: Add tag bits here to the entry
-		if(allocation == 1)
-		{
-			T1_valid[T1_idx] = 1;
-			//T1_tag[T1_idx] = (pc >> (T1_entries - 1)) & tag_mask;
-			T1_tag[T1_idx] = pc & tag_mask;
-			T1_u[T1_idx] = SNU;
-			//prediction counter set to weak correct
-			T1_pred[T1_idx] = (outcome == TAKEN) ? 0 : -1;  
-		}
-		else if(allocation == 2)
-		{
-			T2_valid[T2_idx] = 1;
-			//T2_tag[T2_idx] = (pc >> (T2_entries - 1)) & tag_mask;
-			T2_tag[T2_idx] = pc & tag_mask;
-			T2_u[T2_idx] = SNU;
-			//prediction counter set to weak correct
-			T2_pred[T2_idx] = (outcome == TAKEN) ? 0 : -1;  
-		}
-		else if(allocation == 3)
-		{
-			T3_valid[T3_idx] = 1;
-			//T3_tag[T3_idx] = (pc >> (T3_entries - 1)) & tag_mask;
-			T3_tag[T3_idx] = pc & tag_mask;
-			T3_u[T3_idx] = SNU;
-			//prediction counter set to weak correct
-			T3_pred[T3_idx] = (outcome == TAKEN) ? 0 : -1;  
-		}
-		else if(allocation == 4)
-		{
-			T4_valid[T4_idx] = 1;
-			//T4_tag[T4_idx] = (pc >> (T4_entries - 1)) & tag_mask;
-			T4_tag[T4_idx] = pc & tag_mask;
-			T4_u[T4_idx] = SNU;
-			//prediction counter set to weak correct
-			T4_pred[T4_idx] = (outcome == TAKEN) ? 0 : -1;  
-		}
-		else
-			printf("Warning: something went wrong in choosing randomly between Tj and Tk !\n"); 
-
-
-    } //end of provider != 4 case
-
-
-  } //end of prediction not correct case
+  }
+  //if the provider was NOT the component with the longest history,
+  //allocate a new entry with a longer history
+  else if (provider != geo.tables)
+  {
+    int allocation = choose_allocation();
+    dbg_allocated[allocation]++;
+
+    //initialize the newly allocated entry
+    uint32_t slot = T.slot[allocation - 1];
+    if (geo.way_bits)
+    {
+      uint32_t ways = 1u << geo.way_bits;
+      slot = choose_victim(entries, slot & ~(ways - 1), ways, T.branch_tag[allocation - 1], epoch);
+    }
+    tage_entry &e = entries[slot];
+    e.tag = T.branch_tag[allocation - 1];
+    e.u = TAGE_ALLOC_U | epoch;
+    //prediction counter set to weak correct
+    e.pred = (outcome == TAKEN) ? 0 : -1;
+  }
 
   //periodic alternate reset of usefulness counters
-  periodic_usefulness_reset();
+  age_entries();
+}
 
-  // Update history register
-  ghistory = ((ghistory << 1) | outcome);
+// tage_index() for a branch looked up later, prefetching its T0 word
+// and its sets. The prefetches stay with the stores of the sets and
+// tags, as GCC drops calls to a function that only prefetches
+template <class G>
+void TagePredictor<G>::tage_prefetch(uint32_t pc, uint32_t *slot, uint32_t *tag)
+{
+  tage_index(pc, slot, tag);
+  T0.prefetch(pc & ((1u << geo.bits[0]) - 1));
+  for (int lane = 0; lane < geo.tables; lane++)
+  {
+    __builtin_prefetch(entries + slot[lane]);
+  }
+}
+
+// The outcomes of the whole batch are known, and with them the history
+// and so the sets and tags of every branch. Each branch is indexed
+// 'lookahead' branches before its turn, its lines prefetched then, so
+// they are in the cache when it is looked up
+template <class G>
+void TagePredictor<G>::predict_batch(const branch_batch &batch, uint64_t *branches, uint64_t *mispredictions, uint64_t *predictions)
+{
+  stepped = SIZE_MAX;
+  if (lookahead == 0)
+  {
+    PredictorBase<TagePredictor<G> >::predict_batch(batch, branches, mispredictions, predictions);
+    return;
+  }
+
+  uint64_t num_branches = 0;
+  uint64_t incorrect = 0;
+  if (predictions != NULL)
+  {
+    memset(predictions, 0, (batch.n + 63) / 64 * sizeof(uint64_t));
+  }
+  size_t next = 0;      // the next record to index
+  uint64_t indexed = 0; // branches indexed
+  for (size_t i = 0; i < batch.n; i++)
+  {
+    if (!(batch.flags[i] & TRACE_CONDITION))
+    {
+      continue;
+    }
+    for (; indexed - num_branches <= (uint64_t)lookahead && next < batch.n; next++)
+    {
+      if (batch.flags[next] & TRACE_CONDITION)
+      {
+        tage_prefetch(batch.pc[next], ahead_slot[indexed % TAGE_AHEAD], ahead_tag[indexed % TAGE_AHEAD]);
+        push_history(batch.outcome[next]);
+        indexed++;
+      }
+    }
+
+    uint32_t prediction = tage_predict(batch.pc[i], ahead_slot[num_branches % TAGE_AHEAD], ahead_tag[num_branches % TAGE_AHEAD]);
+    num_branches++;
+    incorrect += (prediction != batch.outcome[i]);
+    if (predictions != NULL)
+    {
+      predictions[i / 64] |= (uint64_t)prediction << (i % 64);
+    }
+    train_tage(batch.pc[i], batch.outcome[i]);
+  }
+  *branches += num_branches;
+  *mispredictions += incorrect;
+}
+
+template <class G>
+size_t TagePredictor<G>::step(const branch_batch &batch, size_t i, uint64_t *branches, uint64_t *mispredictions)
+{
+  // TAGE only sees conditional branches. Once one is trained, the
+  // history is that of the next one, which can be indexed
+  i = next_condition(batch, i);
+  if (i == batch.n)
+  {
+    return i;
+  }
+  (*branches)++;
+  if (i == stepped)
+  {
+    *mispredictions += (tage_predict(batch.pc[i], ahead_slot[0], ahead_tag[0]) != batch.outcome[i]);
+  }
+  else
+  {
+    *mispredictions += (tage_predict(batch.pc[i]) != batch.outcome[i]);
+  }
+  train_tage(batch.pc[i], batch.outcome[i]);
+  push_history(batch.outcome[i]);
+
+  i = next_condition(batch, i + 1);
+  stepped = i;
+  if (i < batch.n)
+  {
+    tage_prefetch(batch.pc[i], ahead_slot[0], ahead_tag[0]);
+  }
+  return i;
 }
 
 
@@ -796,50 +1421,178 @@ void train_tage(uint32_t pc, uint8_t outcome)
 //        Predictor Execution         //
 //------------------------------------//
 
+// A TAGE geometry with a kernel compiled for it
+struct tage_preset
+{
+  const char *name;
+  int tables;
+  const uint32_t *bits;
+  const uint32_t *history;
+  const uint32_t *tag_bits;
+  Predictor *(*create)(const predictor_config *cfg);
+};
+
+template <class S>
+static Predictor *create_fixed_tage(const predictor_config *cfg)
+{
+  return new TagePredictor<tage_fixed_geometry<S> >(cfg);
+}
+
+#define TAGE_PRESET(name, S) {name, S::tables, S::bits, S::history, S::tag_bits, create_fixed_tage<S>}
 
-void init_predictor()
+static const tage_preset tagePresets[] = {
+  TAGE_PRESET("default", tage_default_geometry),
+  TAGE_PRESET("short", tage_short_geometry),
+  TAGE_PRESET("long", tage_long_geometry),
+};
+#define TAGE_PRESETS (sizeof(tagePresets) / sizeof(tagePresets[0]))
+
+// The geometry default_config() gives a TAGE
+static const tage_preset *tagePreset = &tagePresets[0];
+
+int set_tage_config(const char *name)
 {
-  switch (bpType)
+  for (size_t i = 0; i < TAGE_PRESETS; i++)
   {
-  case STATIC:
-    break;
-  case GSHARE:
-    init_gshare();
-    break;
-  case TAGE:
-	init_tage();
-    break;
-  case CUSTOM:
-    break;
-  default:
-    break;
+    if (!strcmp(name, tagePresets[i].name))
+    {
+      tagePreset = &tagePresets[i];
+      return 1;
+    }
   }
+  return 0;
 }
 
-// Make a prediction for conditional branch instruction at PC 'pc'
-// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
-// indicates a prediction of not taken
+// Looks for the preset with the geometry of 'cfg'
+//
+// Returns the preset, NULL if there is none
+//
+static const tage_preset *find_tage_preset(const predictor_config *cfg)
+{
+  for (size_t i = 0; i < TAGE_PRESETS; i++)
+  {
+    const tage_preset &p = tagePresets[i];
+    size_t n = p.tables + 1;
+    if (cfg->tageTables == p.tables && cfg->tageWays == 1 && cfg->tageBits[0] == p.bits[0] &&
+        !memcmp(cfg->tageBits + 1, p.bits + 1, (n - 1) * sizeof(uint32_t)) &&
+        !memcmp(cfg->tageHistory + 1, p.history + 1, (n - 1) * sizeof(uint32_t)) &&
+        !memcmp(cfg->tageTagBits + 1, p.tag_bits + 1, (n - 1) * sizeof(uint32_t)))
+    {
+      return &p;
+    }
+  }
+  return NULL;
+}
 
-uint32_t make_prediction(uint32_t pc, uint32_t target, uint32_t direct)
+void default_config(predictor_config *cfg, int type)
 {
+  memset(cfg, 0, sizeof(*cfg));
+  cfg->bpType = type;
+  cfg->ghistoryBits = ghistoryBits;
+
+  cfg->tageTables = tagePreset->tables;
+  cfg->tageWays = 1;
+  cfg->tageBits[0] = tagePreset->bits[0];
+  for (int t = 1; t <= tagePreset->tables; t++)
+  {
+    cfg->tageBits[t] = tagePreset->bits[t];
+    cfg->tageHistory[t] = tagePreset->history[t];
+    cfg->tageTagBits[t] = tagePreset->tag_bits[t];
+  }
+  cfg->resetPeriod = TAGE_RESET_PERIOD;
+}
 
-  // Make a prediction based on the bpType
-  switch (bpType)
+int valid_config(const predictor_config *cfg)
+{
+  if (cfg->bpType < STATIC || cfg->bpType > CUSTOM)
+  {
+    return 0;
+  }
+  if (cfg->ghistoryBits < 1 || cfg->ghistoryBits > 28)
+  {
+    return 0;
+  }
+  if (cfg->tageTables < 1 || cfg->tageTables > TAGE_MAX_TABLES || cfg->resetPeriod < 1)
+  {
+    return 0;
+  }
+  if (cfg->tageWays < 1 || cfg->tageWays > TAGE_MAX_WAYS || (cfg->tageWays & (cfg->tageWays - 1)))
+  {
+    return 0;
+  }
+  for (int t = 0; t <= cfg->tageTables; t++)
+  {
+    if (cfg->tageBits[t] < 1 || cfg->tageBits[t] > 24)
+    {
+      return 0;
+    }
+    if (t > 0 && (cfg->tageHistory[t] < 1 || cfg->tageHistory[t] > TAGE_MAX_HISTORY ||
+                  cfg->tageTagBits[t] < 1 || cfg->tageTagBits[t] > 16 ||
+                  (1u << cfg->tageBits[t]) < (uint32_t)cfg->tageWays))
+    {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+Predictor *create_predictor(int type)
+{
+  predictor_config cfg;
+  default_config(&cfg, type);
+  return create_predictor(&cfg);
+}
+
+Predictor *create_predictor(const predictor_config *cfg)
+{
+  const tage_preset *preset;
+  switch (cfg->bpType)
   {
   case STATIC:
-    return TAKEN;
+    return new StaticPredictor();
   case GSHARE:
-    return gshare_predict(pc);
+    return new GsharePredictor(cfg);
   case TAGE:
-    return tage_predict(pc);
+    // a geometry with a kernel of its own runs on it, any other on the
+    // generic one
+    preset = find_tage_preset(cfg);
+    if (preset != NULL)
+    {
+      return preset->create(cfg);
+    }
+    return new TagePredictor<tage_geometry>(cfg);
   case CUSTOM:
-    return NOTTAKEN;
+    return new CustomPredictor();
   default:
     break;
   }
 
-  // If there is not a compatable bpType then return NOTTAKEN
-  return NOTTAKEN;
+  // If there is not a compatable bpType then predict NOTTAKEN
+  return new CustomPredictor();
+}
+
+void init_predictor()
+{
+  defaultPredictor = create_predictor(bpType);
+}
+
+void seed_history(const uint64_t *history)
+{
+  defaultPredictor->seed_history(history);
+}
+
+void dbg_prints()
+{
+  defaultPredictor->dbg_prints();
+}
+
+// Make a prediction for conditional branch instruction at PC 'pc'
+// Returning TAKEN indicates a prediction of taken; returning NOTTAKEN
+// indicates a prediction of not taken
+
+uint32_t make_prediction(uint32_t pc, uint32_t target, uint32_t direct)
+{
+  return defaultPredictor->predict(pc, target, direct);
 }
 
 // Train the predictor the last executed branch at PC 'pc' and with
@@ -848,20 +1601,5 @@ uint32_t make_prediction(uint32_t pc, uint32_t target, uint32_t direct)
 
 void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct)
 {
-  if (condition)
-  {
-    switch (bpType)
-    {
-    case STATIC:
-      return;
-    case GSHARE:
-      return train_gshare(pc, outcome);
-    case TAGE:
-      return train_tage(pc, outcome);
-    case CUSTOM:
-      return;
-    default:
-      break;
-    }
-  }
+  defaultPredictor->train(pc, target, outcome, condition, call, ret, direct);
 }
@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 //
 // Student Information
@@ -67,6 +68,11 @@ extern int pcIndexBits;  // Number of bits used for PC index
 extern int bpType;       // Branch Prediction Type
 extern int verbose;
 
+// Conditional branches a batch looks ahead to prefetch the table lines
+// they will use, --lookahead. 0 prefetches nothing
+#define MAX_LOOKAHEAD 64
+extern int lookahead;
+
 //------------------------------------//
 //    Predictor Function Prototypes   //
 //------------------------------------//
@@ -93,4 +99,172 @@ void train_predictor(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t co
 //print out debug variables
 void dbg_prints();
 
+// Seed the global history when simulation starts mid-trace. 'history'
+// holds the outcomes of the conditional branches before the first one
+// simulated, the most recent in bit 0 of history[0]
+//
+void seed_history(const uint64_t *history);
+
+//------------------------------------//
+//        Predictor Instances         //
+//------------------------------------//
+
+// The functions above drive a single predictor of type bpType. Each
+// Predictor below is a self-contained object with its own tables,
+// history and random numbers, so several can run side by side, on as
+// many threads
+struct branch_batch;
+
+// Most tagged components of a TAGE, its longest history, and the most
+// ways of a set, which fill a cache line. The longest history is what a
+// history snapshot holds (64 * HISTORY_SNAPSHOT_WORDS), so runs that
+// seek into the trace start with all of it
+#define TAGE_MAX_TABLES 16
+#define TAGE_MAX_HISTORY 1024
+#define TAGE_MAX_WAYS 16
+
+// The parameters of a predictor
+struct predictor_config
+{
+  int bpType;
+  int ghistoryBits;                           // gshare: history bits, log2 of its entries
+  int tageTables;                             // TAGE: tagged components T1..Tn
+  uint32_t tageBits[TAGE_MAX_TABLES + 1];     // TAGE: log2 of the entries of T0..Tn
+  uint32_t tageHistory[TAGE_MAX_TABLES + 1];  // TAGE: history length of T1..Tn
+  uint32_t tageTagBits[TAGE_MAX_TABLES + 1];  // TAGE: tag bits of T1..Tn
+  int tageWays;                               // TAGE: ways of the sets of T1..Tn, 1 for direct-mapped
+  uint32_t resetPeriod;                       // TAGE: branches between usefulness resets
+};
+
+// Fills 'cfg' with the current configuration of a predictor of type
+// 'type'
+//
+void default_config(predictor_config *cfg, int type);
+
+// Checks 'cfg' against the limits a predictor can be built with, the
+// ones sweep specs are held to: gshare history of 1 to 28 bits, 1 to
+// TAGE_MAX_TABLES tagged tables of 2 to 2^24 entries, histories of 1
+// to TAGE_MAX_HISTORY, tags of 1 to 16 bits, and ways a power of two
+// up to TAGE_MAX_WAYS that no table has fewer entries than
+//
+// Returns False if 'cfg' is outside them
+//
+int valid_config(const predictor_config *cfg);
+
+// Picks the TAGE geometry default_config() fills in, one of the
+// geometries with a kernel compiled for it: default, short or long
+//
+// Returns False if there is no geometry called 'name'
+//
+int set_tage_config(const char *name);
+
+// How a TAGE looks up its tables: auto picks AVX2 when the CPU
+// supports it; avx2 and scalar force a path
+#define TAGE_LOOKUP_AUTO 0
+#define TAGE_LOOKUP_AVX2 1
+#define TAGE_LOOKUP_SCALAR 2
+extern const char *tageLookupName[];
+
+// Picks the lookup of the TAGEs created from now on, --tage-lookup
+//
+// Returns False if 'name' is not one of tageLookupName
+//
+int parse_tage_lookup(const char *name);
+
+// How TAGE applies a usefulness reset: lazily, to a slice of the
+// entries every branch until the next one, or eagerly, to every entry
+// when it comes. Eager aging is the reference make check holds lazy
+// aging to
+#define TAGE_AGING_LAZY 0
+#define TAGE_AGING_EAGER 1
+extern const char *tageAgingName[];
+
+// Picks the aging of the TAGEs created from now on, --tage-aging
+//
+// Returns False if 'name' is not one of tageAgingName
+//
+int parse_tage_aging(const char *name);
+
+// The state of a predictor as a flat image, its fields one after the
+// other, each starting 8-byte aligned. Predictor::checkpoint() walks
+// the fields in a fixed order: with 'data' NULL to size the image,
+// otherwise to copy them into it or, with 'load' set, back out of it
+struct state_image
+{
+  uint8_t *data;
+  size_t size;
+  int load;
+
+  void field(void *p, size_t n)
+  {
+    size = (size + 7) & ~(size_t)7;
+    if (data != NULL && load)
+    {
+      memcpy(p, data + size, n);
+    }
+    else if (data != NULL)
+    {
+      memcpy(data + size, p, n);
+    }
+    size += n;
+  }
+};
+
+class Predictor
+{
+public:
+  virtual ~Predictor() {}
+
+  // make_prediction(), train_predictor() and seed_history() on this
+  // predictor
+  virtual uint32_t predict(uint32_t pc, uint32_t target, uint32_t direct) = 0;
+  virtual void train(uint32_t pc, uint32_t target, uint32_t outcome, uint32_t condition, uint32_t call, uint32_t ret, uint32_t direct) = 0;
+  virtual void seed_history(const uint64_t *history) = 0;
+
+  // Predicts and trains on the records of 'batch' in order, adding its
+  // conditional branches and mispredictions to the counts. When
+  // 'predictions' is not NULL, bit i % 64 of word i / 64 receives the
+  // prediction for record i, 0 for records that are not conditional
+  // branches. Each kind of predictor has a loop of its own, so nothing
+  // is dispatched per branch, and may work on the batch as a whole as
+  // its outcomes are known up front
+  virtual void predict_batch(const branch_batch &batch, uint64_t *branches, uint64_t *mispredictions, uint64_t *predictions) = 0;
+
+  // Simulates the records of 'batch' from record 'i' up to the next
+  // conditional branch, that one included, as predict_batch() would,
+  // and prefetches the table lines of the conditional branch after it.
+  // A caller stepping several predictors in turn hides the misses of
+  // each behind the work of the others. Steps go on from the record
+  // the last one returned, or the first record of a batch
+  //
+  // Returns the record to step from next
+  //
+  virtual size_t step(const branch_batch &batch, size_t i, uint64_t *branches, uint64_t *mispredictions) = 0;
+
+  // Walks 'image' over everything the predictor would need to go on
+  // where it is: tables, history, usefulness aging, random numbers and
+  // debug variables. Lookahead state is dropped on a load, as it is by
+  // seed_history()
+  virtual void checkpoint(state_image &image) = 0;
+
+  // dbg_prints() for this predictor. Only TAGE has debug variables
+  virtual void dbg_prints() {}
+};
+
+// Creates a predictor of type 'type' with the current configuration,
+// or with the configuration in 'cfg'
+//
+Predictor *create_predictor(int type);
+Predictor *create_predictor(const predictor_config *cfg);
+
+// Simulates a gshare for each of the 'n' gshare configurations in 'cfg'
+// over 'batch', all in one pass, adding the conditional branches to
+// 'branches' and the mispredictions of configuration i to
+// mispredictions[i]. 'history' seeds them when the records start
+// mid-trace, and is NULL otherwise. Each gshare predicts exactly what
+// a predictor of its own would
+//
+void predict_gshares(const branch_batch &batch, const uint64_t *history, const predictor_config *cfg, int n,
+                     uint64_t *branches, uint64_t *mispredictions);
+
 #endif
@@ -0,0 +1,166 @@
+//========================================================//
+//  sample.cpp                                            //
+//  Source file for sampled simulation                    //
+//                                                        //
+//  SimPoint files in, per-interval and weighted rates    //
+//  with confidence intervals out                         //
+//========================================================//
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include "sample.h"
+
+// Handy Global for use in output routines
+const char *ffModeName[2] = {"skip", "warm"};
+
+int parse_ff_mode(const char *name)
+{
+  for (int i = 0; i < 2; i++)
+  {
+    if (!strcmp(name, ffModeName[i]))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int load_simpoints(const char *path, uint64_t length, std::vector<sample_interval> &intervals)
+{
+  FILE *stream = fopen(path, "r");
+  if (stream == NULL)
+  {
+    perror(path);
+    return 0;
+  }
+
+  char line[256];
+  int lineno = 0;
+  while (fgets(line, sizeof(line), stream) != NULL)
+  {
+    lineno++;
+    unsigned long long index;
+    double weight;
+    char extra;
+    int fields = sscanf(line, "%llu %lf %c", &index, &weight, &extra);
+    if (fields <= 0)
+    {
+      continue;
+    }
+    if (fields != 2 || weight < 0)
+    {
+      fprintf(stderr, "%s:%d: expected <interval> <weight>\n", path, lineno);
+      fclose(stream);
+      return 0;
+    }
+
+    sample_interval interval;
+    memset(&interval, 0, sizeof(interval));
+    interval.start = index * length;
+    interval.length = length;
+    interval.weight = weight;
+    intervals.push_back(interval);
+  }
+  fclose(stream);
+
+  std::sort(intervals.begin(), intervals.end(), [](const sample_interval &a, const sample_interval &b) {
+    return a.start < b.start;
+  });
+  for (size_t i = 1; i < intervals.size(); i++)
+  {
+    if (intervals[i].start == intervals[i - 1].start)
+    {
+      fprintf(stderr, "%s: interval %llu is listed twice\n", path,
+              (unsigned long long)(intervals[i].start / length));
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Two-sided 95% quantile of Student's t with 'df' degrees of freedom,
+// from a table up to 30 and the Cornish-Fisher expansion beyond
+static double t_quantile_95(size_t df)
+{
+  static const double table[30] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+  if (df <= 30)
+  {
+    return table[df - 1];
+  }
+  double z = 1.959964;
+  double z3 = z * z * z;
+  double z5 = z3 * z * z;
+  double n = df;
+  return z + (z3 + z) / (4 * n) + (5 * z5 + 16 * z3 + 3 * z) / (96 * n * n);
+}
+
+void print_samples(const std::vector<sample_interval> &intervals, int simpoints)
+{
+  // only complete intervals with conditional branches have a rate
+  std::vector<double> rate, weight;
+  uint64_t branches = 0;
+  uint64_t mispredictions = 0;
+  double total = 0;
+  for (size_t i = 0; i < intervals.size(); i++)
+  {
+    const sample_interval &s = intervals[i];
+    double r = s.branches ? 100.0 * s.mispredictions / s.branches : 0;
+    printf("Interval %6zu: start %12llu  branches %10llu  incorrect %10llu  rate %7.3f percent",
+           i, (unsigned long long)s.start, (unsigned long long)s.branches,
+           (unsigned long long)s.mispredictions, r);
+    if (simpoints)
+    {
+      printf("  weight %.4f", s.weight);
+    }
+    printf("%s\n", s.complete ? "" : "  (trace ended)");
+
+    if (!s.complete || s.branches == 0)
+    {
+      continue;
+    }
+    rate.push_back(r);
+    weight.push_back(simpoints ? s.weight : (double)s.branches);
+    total += weight.back();
+    branches += s.branches;
+    mispredictions += s.mispredictions;
+  }
+
+  printf("Branches:        %10llu\n", (unsigned long long)branches);
+  printf("Incorrect:       %10llu\n", (unsigned long long)mispredictions);
+  printf("Misprediction Rate: %7.3f percent\n", branches ? 100.0 * mispredictions / branches : 0.0);
+  printf("Sampled Intervals: %8zu\n", rate.size());
+  if (rate.empty() || total <= 0)
+  {
+    return;
+  }
+
+  // weighted mean, and its standard error from the unbiased weighted
+  // variance (1 / sum(w^2) is the effective number of samples)
+  double mean = 0;
+  double sum_sq = 0;
+  for (size_t i = 0; i < rate.size(); i++)
+  {
+    weight[i] /= total;
+    mean += weight[i] * rate[i];
+    sum_sq += weight[i] * weight[i];
+  }
+  printf("Weighted Rate:   %7.3f percent", mean);
+  if (sum_sq < 1)
+  {
+    double var = 0;
+    for (size_t i = 0; i < rate.size(); i++)
+    {
+      var += weight[i] * (rate[i] - mean) * (rate[i] - mean);
+    }
+    var /= 1 - sum_sq;
+    // Student's t rather than the normal 1.96, which understates the
+    // interval badly for a handful of samples
+    size_t df = rate.size() - 1;
+    printf(" +/- %.3f (95%% confidence, Student's t, %zu d.f.)", t_quantile_95(df) * sqrt(var * sum_sq), df);
+  }
+  printf("\n");
+}
@@ -0,0 +1,51 @@
+//========================================================//
+//  sample.h                                              //
+//  Header file for sampled simulation                    //
+//                                                        //
+//  Plans the measured intervals of a sampled run and     //
+//  reports their weighted misprediction rate             //
+//========================================================//
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+#include <vector>
+
+// What happens to the branches between measured intervals
+#define FF_SKIP 0 // not simulated, only the global history is kept
+#define FF_WARM 1 // simulated to keep the predictor warm, not counted
+extern const char *ffModeName[];
+
+// Parses a --fast-forward value
+//
+// Returns the FF_* constant, -1 if the name is unknown
+//
+int parse_ff_mode(const char *name);
+
+// A measured interval of a sampled run
+struct sample_interval
+{
+  uint64_t start;          // first branch, counted from the start of the run
+  uint64_t length;         // branches measured
+  double weight;           // SimPoint weight, ignored by systematic sampling
+  uint64_t branches;       // conditional branches in the interval
+  uint64_t mispredictions;
+  int complete;            // the trace did not end inside the interval
+};
+
+// Reads a SimPoint file: one "<interval> <weight>" pair per line, the
+// interval counted in units of 'length' branches. The intervals are
+// sorted by start
+//
+// Returns False if the file cannot be read or intervals repeat
+//
+int load_simpoints(const char *path, uint64_t length, std::vector<sample_interval> &intervals);
+
+// Prints the rate of every interval and their aggregate with its 95%
+// confidence interval. Intervals are weighted by their SimPoint weight
+// when 'simpoints' is set, otherwise by their conditional branches
+//
+void print_samples(const std::vector<sample_interval> &intervals, int simpoints);
+
+#endif
@@ -0,0 +1,151 @@
+//========================================================//
+//  shard.cpp                                             //
+//  Source file for sharded simulation                    //
+//                                                        //
+//  One trace in, a shard of it per thread, one merged    //
+//  result out                                            //
+//========================================================//
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "shard.h"
+
+int shardCount = 1;
+uint64_t shardWarmup = 1000000;
+int shardCheck = 0;
+
+// Builds the history snapshot at branch 'first' of 'recs', out of
+// 'history', the snapshot at the start of the records or NULL
+//
+static void shard_history(const branch_columns &recs, const uint64_t *history, uint64_t first, uint64_t *snapshot)
+{
+  branch_batch batch = recs.view(0, recs.size());
+
+  // only the last 64 * HISTORY_SNAPSHOT_WORDS conditional branches
+  // before 'first' make it into the snapshot
+  uint64_t from = first;
+  for (int seen = 0; from > 0 && seen < 64 * HISTORY_SNAPSHOT_WORDS; from--)
+  {
+    seen += (batch.flags[from - 1] & TRACE_CONDITION) != 0;
+  }
+
+  if (history != NULL)
+  {
+    memcpy(snapshot, history, HISTORY_SNAPSHOT_WORDS * sizeof(uint64_t));
+  }
+  else
+  {
+    memset(snapshot, 0, HISTORY_SNAPSHOT_WORDS * sizeof(uint64_t));
+  }
+  for (uint64_t i = from; i < first; i++)
+  {
+    if (batch.flags[i] & TRACE_CONDITION)
+    {
+      push_history(snapshot, batch.outcome[i]);
+    }
+  }
+}
+
+static void simulate_shard(const branch_columns &recs, const uint64_t *history, int type, shard_result *s)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  Predictor *bp = create_predictor(type);
+  uint64_t warm_start = s->first - s->warmup;
+  if (history != NULL || warm_start > 0)
+  {
+    uint64_t snapshot[HISTORY_SNAPSHOT_WORDS];
+    shard_history(recs, history, warm_start, snapshot);
+    bp->seed_history(snapshot);
+  }
+
+  uint64_t branches = 0;
+  uint64_t mispredictions = 0;
+  if (s->warmup > 0)
+  {
+    bp->predict_batch(recs.view(warm_start, s->warmup), &branches, &mispredictions, NULL);
+    branches = 0;
+    mispredictions = 0;
+  }
+  bp->predict_batch(recs.view(s->first, s->length), &branches, &mispredictions, NULL);
+  delete bp;
+
+  s->branches = branches;
+  s->mispredictions = mispredictions;
+  s->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void run_shards(const branch_columns &recs, const uint64_t *history, int type,
+                std::vector<shard_result> &shards, shard_result *exact)
+{
+  uint64_t n = recs.size();
+  uint64_t count = std::max((uint64_t)1, std::min((uint64_t)shardCount, n));
+  shards.resize(count);
+  for (uint64_t i = 0; i < count; i++)
+  {
+    shard_result &s = shards[i];
+    memset(&s, 0, sizeof(s));
+    s.first = i * n / count;
+    s.length = (i + 1) * n / count - s.first;
+    s.warmup = std::min(s.first, shardWarmup);
+  }
+
+  std::vector<std::thread> workers;
+  for (uint64_t i = 0; i < count; i++)
+  {
+    workers.push_back(std::thread(simulate_shard, std::cref(recs), history, type, &shards[i]));
+  }
+  for (size_t i = 0; i < workers.size(); i++)
+  {
+    workers[i].join();
+  }
+
+  // after the shards, not beside them, so neither skews the time of
+  // the other
+  if (exact != NULL)
+  {
+    memset(exact, 0, sizeof(*exact));
+    exact->length = n;
+    simulate_shard(recs, history, type, exact);
+  }
+}
+
+void print_shards(const std::vector<shard_result> &shards, const shard_result *exact)
+{
+  uint64_t branches = 0;
+  uint64_t mispredictions = 0;
+  double seconds = 0;
+  printf("%5s %12s %12s %12s %12s %9s %9s\n", "Shard", "First", "Warmup", "Branches", "Incorrect", "Rate",
+         "Seconds");
+  for (size_t i = 0; i < shards.size(); i++)
+  {
+    const shard_result &s = shards[i];
+    printf("%5zu %12llu %12llu %12llu %12llu %8.3f%% %9.2f\n", i, (unsigned long long)s.first,
+           (unsigned long long)s.warmup, (unsigned long long)s.branches, (unsigned long long)s.mispredictions,
+           s.branches ? 100.0 * s.mispredictions / s.branches : 0.0, s.seconds);
+    branches += s.branches;
+    mispredictions += s.mispredictions;
+    seconds = std::max(seconds, s.seconds);
+  }
+
+  printf("\nBranches:        %10llu\n", (unsigned long long)branches);
+  printf("Incorrect:       %10llu\n", (unsigned long long)mispredictions);
+  float mispredict_rate = 100 * ((float)mispredictions / (float)branches);
+  printf("Misprediction Rate: %7.3f percent\n", mispredict_rate);
+  if (exact == NULL)
+  {
+    return;
+  }
+
+  // every branch is measured by exactly one shard, so only the
+  // mispredictions can differ from the sequential run
+  double exact_rate = exact->branches ? 100.0 * exact->mispredictions / exact->branches : 0.0;
+  double rate = branches ? 100.0 * mispredictions / branches : 0.0;
+  printf("\nSequential Incorrect: %10llu  (%7.3f percent, %.2f seconds)\n",
+         (unsigned long long)exact->mispredictions, exact_rate, exact->seconds);
+  printf("Shard Error:     %+10lld  (%+7.3f percent points, %+.3f%% of the sequential)\n",
+         (long long)mispredictions - (long long)exact->mispredictions, rate - exact_rate,
+         exact->mispredictions ? 100.0 * ((double)mispredictions / exact->mispredictions - 1) : 0.0);
+  printf("Speedup:         %10.2fx\n", seconds > 0 ? exact->seconds / seconds : 0.0);
+}
@@ -0,0 +1,56 @@
+//========================================================//
+//  shard.h                                               //
+//  Header file for sharded simulation                    //
+//                                                        //
+//  Splits one trace into contiguous shards, simulates    //
+//  them on threads of their own and merges the results   //
+//========================================================//
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stdint.h>
+#include <vector>
+#include "predictor.h"
+#include "trace.h"
+
+// Shards of --shards, 1 for an ordinary sequential run
+extern int shardCount;
+
+// Branches of the previous shard each shard replays before it measures
+// its own, --shard-warmup
+extern uint64_t shardWarmup;
+
+// Whether to run the exact sequential simulation as well, --shard-check
+extern int shardCheck;
+
+// A shard of the trace, and its result once run
+struct shard_result
+{
+  uint64_t first;          // first branch of the shard
+  uint64_t length;         // branches of the shard
+  uint64_t warmup;         // branches before 'first' simulated, not counted
+  uint64_t branches;       // conditional branches measured
+  uint64_t mispredictions;
+  double seconds;          // time spent on warmup and measurement
+};
+
+// Splits 'recs' into shardCount shards of about the same length and
+// simulates each on a thread of its own with a fresh predictor of
+// 'type'. A shard seeds the global history of the branches before its
+// warmup, then warms up over the shardWarmup branches before it, the
+// tail of the shard before. With 'exact' set the whole trace is
+// simulated once more into it, sequentially once the shards are done.
+// 'history' seeds the predictors when the records start mid-trace, and
+// is NULL otherwise
+//
+void run_shards(const branch_columns &recs, const uint64_t *history, int type,
+                std::vector<shard_result> &shards, shard_result *exact);
+
+// Prints every shard, their merged statistics and, when 'exact' is not
+// NULL, how far the merged mispredictions are from the sequential run
+// and how much faster than it the slowest shard was
+//
+void print_shards(const std::vector<shard_result> &shards, const shard_result *exact);
+
+#endif
@@ -0,0 +1,615 @@
+//========================================================//
+//  sweep.cpp                                             //
+//  Source file for parameter sweeps                      //
+//                                                        //
+//  Sweep files in, one table of results out. The points  //
+//  run on a work-stealing pool of threads                //
+//========================================================//
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "sweep.h"
+
+int sweepThreads = 0;
+int sweepInterleave = 1;
+
+// Predictor types as they are written in specs
+static const char *specName[4] = {"static", "gshare", "tage", "custom"};
+
+// The params of a spec
+struct sweep_param
+{
+  const char *name;
+  int type;     // predictor type the param belongs to
+  int width;    // numbers per value, 0 for one or one per tagged table
+  uint32_t min;
+  uint32_t max;
+};
+
+static const sweep_param sweepParams[] = {
+  {"hist", GSHARE, 1, 1, 28},
+  {"n", TAGE, 1, 1, TAGE_MAX_TABLES},
+  {"L0", TAGE, 1, 1, 24},
+  {"L", TAGE, 0, 1, 24},
+  {"hist", TAGE, 0, 1, TAGE_MAX_HISTORY},
+  {"geo", TAGE, 2, 1, TAGE_MAX_HISTORY},
+  {"tag", TAGE, 0, 1, 16},
+  {"reset", TAGE, 1, 1, 0xffffffff},
+  {"ways", TAGE, 1, 1, TAGE_MAX_WAYS},
+};
+#define SWEEP_PARAMS (sizeof(sweepParams) / sizeof(sweepParams[0]))
+
+// A configuration while its spec is expanded. The per-table params
+// only make sense once the number of tables is known, so they are kept
+// as written until then
+struct spec_config
+{
+  predictor_config cfg;
+  std::vector<uint32_t> L;
+  std::vector<uint32_t> hist;
+  std::vector<uint32_t> geo;
+  std::vector<uint32_t> tag;
+};
+
+static void set_param(spec_config *spec, size_t param, const std::vector<uint32_t> &v)
+{
+  switch (param)
+  {
+  case 0:
+    spec->cfg.ghistoryBits = v[0];
+    break;
+  case 1:
+    spec->cfg.tageTables = v[0];
+    break;
+  case 2:
+    spec->cfg.tageBits[0] = v[0];
+    break;
+  case 3:
+    spec->L = v;
+    break;
+  case 4:
+    spec->hist = v;
+    break;
+  case 5:
+    spec->geo = v;
+    break;
+  case 6:
+    spec->tag = v;
+    break;
+  case 7:
+    spec->cfg.resetPeriod = v[0];
+    break;
+  case 8:
+    spec->cfg.tageWays = v[0];
+    break;
+  }
+}
+
+// Spreads a per-table param over T1..Tn: one value for all of them, or
+// one each
+//
+// Returns False if it has any other number of values
+//
+static int set_tables(uint32_t *field, int tables, const std::vector<uint32_t> &v)
+{
+  if (v.size() != 1 && v.size() != (size_t)tables)
+  {
+    return 0;
+  }
+  for (int t = 1; t <= tables; t++)
+  {
+    field[t] = v[v.size() == 1 ? 0 : t - 1];
+  }
+  return 1;
+}
+
+// Fills in the tables of a TAGE spec. Tables the defaults do not cover
+// repeat the last default one, and without 'hist' or 'geo' every table
+// keeps as much history as it has index bits
+//
+// Returns False if the per-table params do not fit the tables, or a
+// table has fewer entries than the ways of a set
+//
+static int finish_tage(spec_config *spec)
+{
+  predictor_config *cfg = &spec->cfg;
+  int tables = cfg->tageTables;
+  for (int t = 5; t <= tables; t++)
+  {
+    cfg->tageBits[t] = cfg->tageBits[4];
+    cfg->tageTagBits[t] = cfg->tageTagBits[4];
+  }
+  if ((!spec->L.empty() && !set_tables(cfg->tageBits, tables, spec->L)) ||
+      (!spec->tag.empty() && !set_tables(cfg->tageTagBits, tables, spec->tag)))
+  {
+    return 0;
+  }
+  if (cfg->tageWays & (cfg->tageWays - 1))
+  {
+    return 0;
+  }
+  for (int t = 1; t <= tables; t++)
+  {
+    if ((1u << cfg->tageBits[t]) < (uint32_t)cfg->tageWays)
+    {
+      return 0;
+    }
+  }
+
+  if (!spec->hist.empty() && !spec->geo.empty())
+  {
+    return 0;
+  }
+  if (!spec->hist.empty())
+  {
+    return set_tables(cfg->tageHistory, tables, spec->hist);
+  }
+  if (!spec->geo.empty())
+  {
+    // a geometric series from the shortest history to the longest
+    double shortest = spec->geo[0];
+    double longest = spec->geo[1];
+    for (int t = 1; t <= tables; t++)
+    {
+      double step = tables > 1 ? (t - 1.0) / (tables - 1) : 0;
+      cfg->tageHistory[t] = (uint32_t)(shortest * pow(longest / shortest, step) + 0.5);
+    }
+    return 1;
+  }
+  for (int t = 1; t <= tables; t++)
+  {
+    cfg->tageHistory[t] = cfg->tageBits[t];
+  }
+  return 1;
+}
+
+// Appends T1..Tn of 'field' to a label, once if they are all the same
+static size_t format_tables(char *label, size_t size, const char *name, const uint32_t *field, int tables)
+{
+  int same = std::count(field + 1, field + tables + 1, field[1]) == tables;
+  size_t len = snprintf(label, size, ":%s=%u", name, field[1]);
+  for (int t = 2; !same && t <= tables && len < size; t++)
+  {
+    len += snprintf(label + len, size - len, "/%u", field[t]);
+  }
+  return std::min(len, size);
+}
+
+static void format_config(const predictor_config *cfg, char *label, size_t size)
+{
+  switch (cfg->bpType)
+  {
+  case GSHARE:
+    snprintf(label, size, "gshare:hist=%d", cfg->ghistoryBits);
+    break;
+  case TAGE:
+  {
+    size_t len = snprintf(label, size, "tage:n=%d:L0=%u", cfg->tageTables, cfg->tageBits[0]);
+    len += format_tables(label + len, size - len, "L", cfg->tageBits, cfg->tageTables);
+    len += format_tables(label + len, size - len, "hist", cfg->tageHistory, cfg->tageTables);
+    len += format_tables(label + len, size - len, "tag", cfg->tageTagBits, cfg->tageTables);
+    snprintf(label + len, size - len, ":ways=%d:reset=%u", cfg->tageWays, cfg->resetPeriod);
+    break;
+  }
+  default:
+    snprintf(label, size, "%s", specName[cfg->bpType]);
+    break;
+  }
+}
+
+// Parses a number that makes up all of 'text'
+//
+// Returns False if it is not one
+//
+static int parse_number(const char *text, uint32_t *value)
+{
+  char *end;
+  unsigned long long v = strtoull(text, &end, 10);
+  if (end == text || *end != '\0' || *text == '-' || v > 0xffffffffull)
+  {
+    return 0;
+  }
+  *value = v;
+  return 1;
+}
+
+// Parses the value list of param 'param' into 'values'. A range 'a..b'
+// stands for one single-number value per number in it
+//
+// Returns False if it is malformed or out of range
+//
+static int parse_values(char *text, size_t param, std::vector<std::vector<uint32_t> > &values)
+{
+  const sweep_param &p = sweepParams[param];
+  char *save;
+  for (char *item = strtok_r(text, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+  {
+    uint32_t v[2];
+    char *dots = strstr(item, "..");
+    if (p.width != 2 && dots != NULL)
+    {
+      *dots = '\0';
+      if (!parse_number(item, &v[0]) || !parse_number(dots + 2, &v[1]) || v[0] > v[1])
+      {
+        return 0;
+      }
+      if (v[0] < p.min || v[1] > p.max)
+      {
+        return 0;
+      }
+      for (uint64_t x = v[0]; x <= v[1]; x++)
+      {
+        values.push_back(std::vector<uint32_t>(1, x));
+      }
+      continue;
+    }
+
+    std::vector<uint32_t> value;
+    char *part_save;
+    for (char *part = strtok_r(item, "/", &part_save); part != NULL; part = strtok_r(NULL, "/", &part_save))
+    {
+      if (!parse_number(part, &v[0]) || v[0] < p.min || v[0] > p.max)
+      {
+        return 0;
+      }
+      value.push_back(v[0]);
+    }
+    if (value.empty() || (p.width != 0 && value.size() != (size_t)p.width) || value.size() > TAGE_MAX_TABLES)
+    {
+      return 0;
+    }
+    values.push_back(value);
+  }
+  return !values.empty();
+}
+
+// Expands the spec in 'line' into 'points'
+//
+// Returns False if it is malformed
+//
+static int parse_spec(char *line, std::vector<sweep_point> &points)
+{
+  char *save;
+  char *type_name = strtok_r(line, ":", &save);
+  int type = -1;
+  for (int i = 0; i < 4; i++)
+  {
+    if (!strcasecmp(type_name, specName[i]))
+    {
+      type = i;
+    }
+  }
+  if (type < 0)
+  {
+    return 0;
+  }
+
+  std::vector<spec_config> configs(1);
+  default_config(&configs[0].cfg, type);
+  for (char *field = strtok_r(NULL, ":", &save); field != NULL; field = strtok_r(NULL, ":", &save))
+  {
+    char *eq = strchr(field, '=');
+    if (eq == NULL)
+    {
+      return 0;
+    }
+    *eq = '\0';
+    size_t param = 0;
+    while (param < SWEEP_PARAMS && (strcmp(field, sweepParams[param].name) || sweepParams[param].type != type))
+    {
+      param++;
+    }
+    std::vector<std::vector<uint32_t> > values;
+    if (param == SWEEP_PARAMS || !parse_values(eq + 1, param, values))
+    {
+      return 0;
+    }
+
+    // every configuration so far, with every value of the param
+    std::vector<spec_config> expanded;
+    for (size_t i = 0; i < configs.size(); i++)
+    {
+      for (size_t v = 0; v < values.size(); v++)
+      {
+        expanded.push_back(configs[i]);
+        set_param(&expanded.back(), param, values[v]);
+      }
+    }
+    configs.swap(expanded);
+  }
+
+  for (size_t i = 0; i < configs.size(); i++)
+  {
+    if (type == TAGE && !finish_tage(&configs[i]))
+    {
+      return 0;
+    }
+    sweep_point p;
+    memset(&p, 0, sizeof(p));
+    p.config = configs[i].cfg;
+    format_config(&p.config, p.label, sizeof(p.label));
+    points.push_back(p);
+  }
+  return 1;
+}
+
+int load_sweep(const char *path, std::vector<sweep_point> &points)
+{
+  FILE *stream = fopen(path, "r");
+  if (stream == NULL)
+  {
+    perror(path);
+    return 0;
+  }
+
+  char line[1024];
+  int lineno = 0;
+  while (fgets(line, sizeof(line), stream) != NULL)
+  {
+    lineno++;
+    line[strcspn(line, "#")] = '\0';
+    char *spec = line + strspn(line, " \t\r\n");
+    spec[strcspn(spec, " \t\r\n")] = '\0';
+    if (*spec == '\0')
+    {
+      continue;
+    }
+    if (!parse_spec(spec, points))
+    {
+      fprintf(stderr, "%s:%d: bad predictor spec\n", path, lineno);
+      fclose(stream);
+      return 0;
+    }
+  }
+  fclose(stream);
+
+  if (points.empty())
+  {
+    fprintf(stderr, "%s: no predictor specs\n", path);
+    return 0;
+  }
+  return 1;
+}
+
+void load_records(TraceReader *reader, branch_columns &recs)
+{
+  const branch_record *batch;
+  size_t n;
+  while ((n = reader->next_batch(&batch)) > 0)
+  {
+    recs.append(batch, n);
+  }
+}
+
+//------------------------------------//
+//            Sweep Threads           //
+//------------------------------------//
+
+// The jobs dealt to a thread, each one point or a group of gshare
+// points run together. Its owner takes them from the back, thieves
+// from the front
+struct sweep_queue
+{
+  std::mutex lock;
+  std::deque<size_t> jobs;
+};
+
+// Takes the next job for thread 'self', stealing one when its own
+// queue is empty. Jobs are never added once the threads run, so all
+// queues being empty means the sweep is done
+//
+// Returns False when there are no jobs left
+//
+static int take_job(std::vector<sweep_queue> &queues, size_t self, size_t *job)
+{
+  for (size_t k = 0; k < queues.size(); k++)
+  {
+    sweep_queue &q = queues[(self + k) % queues.size()];
+    std::lock_guard<std::mutex> hold(q.lock);
+    if (q.jobs.empty())
+    {
+      continue;
+    }
+    if (k == 0)
+    {
+      *job = q.jobs.back();
+      q.jobs.pop_back();
+    }
+    else
+    {
+      *job = q.jobs.front();
+      q.jobs.pop_front();
+    }
+    return 1;
+  }
+  return 0;
+}
+
+static void simulate_point(const branch_columns &recs, const uint64_t *history, sweep_point *p)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  Predictor *bp = create_predictor(&p->config);
+  if (history != NULL)
+  {
+    bp->seed_history(history);
+  }
+
+  uint64_t branches = 0;
+  uint64_t mispredictions = 0;
+  bp->predict_batch(recs.view(0, recs.size()), &branches, &mispredictions, NULL);
+  delete bp;
+
+  p->branches = branches;
+  p->mispredictions = mispredictions;
+  p->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Simulates the points of 'group' on one thread, a conditional branch
+// of each in turn, so the misses of each are prefetched while the
+// others run. The time of the group is shared evenly by its points
+//
+static void simulate_group(const branch_columns &recs, const uint64_t *history, std::vector<sweep_point *> &group)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  branch_batch batch = recs.view(0, recs.size());
+  std::vector<Predictor *> bp(group.size());
+  std::vector<size_t> next(group.size(), 0);
+  for (size_t k = 0; k < group.size(); k++)
+  {
+    bp[k] = create_predictor(&group[k]->config);
+    if (history != NULL)
+    {
+      bp[k]->seed_history(history);
+    }
+    group[k]->branches = 0;
+    group[k]->mispredictions = 0;
+  }
+
+  size_t running = group.size();
+  while (running > 0)
+  {
+    running = 0;
+    for (size_t k = 0; k < group.size(); k++)
+    {
+      if (next[k] < batch.n)
+      {
+        next[k] = bp[k]->step(batch, next[k], &group[k]->branches, &group[k]->mispredictions);
+        running++;
+      }
+    }
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  for (size_t k = 0; k < group.size(); k++)
+  {
+    delete bp[k];
+    group[k]->seconds = seconds / group.size();
+  }
+}
+
+// Simulates the gshare points of 'group' in one pass over 'recs' with
+// predict_gshares(). The time of the group is shared evenly by its
+// points
+//
+static void simulate_gshares(const branch_columns &recs, const uint64_t *history, std::vector<sweep_point *> &group)
+{
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<predictor_config> cfg(group.size());
+  std::vector<uint64_t> mispredictions(group.size(), 0);
+  for (size_t k = 0; k < group.size(); k++)
+  {
+    cfg[k] = group[k]->config;
+  }
+  uint64_t branches = 0;
+  predict_gshares(recs.view(0, recs.size()), history, cfg.data(), group.size(), &branches, mispredictions.data());
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  for (size_t k = 0; k < group.size(); k++)
+  {
+    group[k]->branches = branches;
+    group[k]->mispredictions = mispredictions[k];
+    group[k]->seconds = seconds / group.size();
+  }
+}
+
+void run_sweep(const branch_columns &recs, const uint64_t *history, std::vector<sweep_point> &points)
+{
+  size_t threads = sweepThreads;
+  if (threads == 0)
+  {
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  threads = std::min(threads, points.size());
+
+  // the gshare points are fused into one group per thread, each run in
+  // one pass over the records. Every other point is a job of its own
+  std::vector<std::vector<sweep_point *> > jobs;
+  std::vector<sweep_point *> gshares;
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    if (points[i].config.bpType == GSHARE)
+    {
+      gshares.push_back(&points[i]);
+    }
+    else
+    {
+      jobs.push_back(std::vector<sweep_point *>(1, &points[i]));
+    }
+  }
+  size_t groups = std::min(threads, gshares.size());
+  for (size_t g = 0; g < groups; g++)
+  {
+    jobs.push_back(std::vector<sweep_point *>(gshares.begin() + gshares.size() * g / groups,
+                                              gshares.begin() + gshares.size() * (g + 1) / groups));
+  }
+
+  std::vector<sweep_queue> queues(threads);
+  for (size_t i = 0; i < jobs.size(); i++)
+  {
+    queues[i % threads].jobs.push_back(i);
+  }
+
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < threads; t++)
+  {
+    workers.push_back(std::thread([&, t]() {
+      size_t job;
+      std::vector<sweep_point *> group;
+      for (;;)
+      {
+        group.clear();
+        while (group.size() < (size_t)sweepInterleave && take_job(queues, t, &job))
+        {
+          if (jobs[job].size() > 1)
+          {
+            simulate_gshares(recs, history, jobs[job]);
+            continue;
+          }
+          group.push_back(jobs[job][0]);
+        }
+        if (group.size() == 1)
+        {
+          simulate_point(recs, history, group[0]);
+        }
+        else if (group.size() > 1)
+        {
+          simulate_group(recs, history, group);
+        }
+        else
+        {
+          break;
+        }
+      }
+    }));
+  }
+  for (size_t t = 0; t < threads; t++)
+  {
+    workers[t].join();
+  }
+}
+
+void print_sweep(const std::vector<sweep_point> &points)
+{
+  int width = 56;
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    width = std::max(width, (int)strlen(points[i].label));
+  }
+
+  printf("%-*s %12s %12s %9s %9s %9s\n", width, "Configuration", "Branches", "Incorrect", "Rate", "Seconds",
+         "ns/Branch");
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    const sweep_point &p = points[i];
+    printf("%-*s %12llu %12llu %8.3f%% %9.2f %9.1f\n", width, p.label, (unsigned long long)p.branches,
+           (unsigned long long)p.mispredictions,
+           p.branches ? 100.0 * p.mispredictions / p.branches : 0.0, p.seconds,
+           p.branches ? 1e9 * p.seconds / p.branches : 0.0);
+  }
+}
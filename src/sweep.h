@@ -0,0 +1,76 @@
+//========================================================//
+//  sweep.h                                               //
+//  Header file for parameter sweeps                      //
+//                                                        //
+//  Expands a sweep file into predictor configurations    //
+//  and runs them all over one in-memory copy of a trace  //
+//========================================================//
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <stdint.h>
+#include <vector>
+#include "predictor.h"
+#include "trace.h"
+
+// Number of sweep threads, 0 picks one per core
+extern int sweepThreads;
+
+// Points each sweep thread simulates side by side, --interleave
+extern int sweepInterleave;
+
+// A configuration of a sweep, and its result once run
+struct sweep_point
+{
+  predictor_config config;
+  char label[256];         // the configuration as a spec
+  uint64_t branches;       // conditional branches
+  uint64_t mispredictions;
+  double seconds;          // time spent simulating it
+};
+
+// Reads a sweep file. Every line is a predictor spec
+//
+//   <type>[:<param>=<values>]...
+//
+// and stands for every combination of the values it lists. A value
+// list is comma separated, each item a number or a range 'a..b'. The
+// params are
+//
+//   gshare  hist    global history bits
+//   tage    n       tagged tables T1..Tn
+//           L0      log2 of the entries of T0
+//           L       log2 of the entries of T1..Tn
+//           hist    global history of T1..Tn
+//           geo     history lengths as a geometric series, 'shortest/longest'
+//           tag     tag bits of T1..Tn
+//           ways    ways of the sets of T1..Tn, a power of two
+//           reset   branches between usefulness resets
+//
+// The per-table params take one number for all the tables, or one each
+// as 'a/b/c/...'. Params left out keep their default value. '#' starts
+// a comment
+//
+// Returns False if the file cannot be read or a spec is malformed
+//
+int load_sweep(const char *path, std::vector<sweep_point> &points);
+
+// Reads the rest of 'reader' into 'recs', as columns
+//
+void load_records(TraceReader *reader, branch_columns &recs);
+
+// Simulates every point over 'recs' on sweepThreads threads, filling
+// in their results. The records are shared read-only; each thread runs
+// whole points, sweepInterleave at a time, and steals points from the
+// others when it runs out.
+// 'history' seeds the predictors when the records start mid-trace, and
+// is NULL otherwise
+//
+void run_sweep(const branch_columns &recs, const uint64_t *history, std::vector<sweep_point> &points);
+
+// Prints the results of a sweep as one table
+//
+void print_sweep(const std::vector<sweep_point> &points);
+
+#endif
@@ -0,0 +1,412 @@
+//========================================================//
+//  textparse.cpp                                         //
+//  Source file for the text trace parser                 //
+//                                                        //
+//  Delimiters are located a 64 byte word at a time with  //
+//  AVX2 or SSE4.2 compares, hex fields are decoded with  //
+//  SWAR arithmetic, anything unusual goes to sscanf      //
+//========================================================//
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <immintrin.h>
+#include "textparse.h"
+
+// Handy Global for use in output routines
+const char *textParserName[5] = {"auto", "avx2", "sse4.2", "scalar", "sscanf"};
+
+int textParser = TEXT_PARSER_AUTO;
+
+// Bytes scanned for delimiters at a time, so the masks stay in L1
+#define SCAN_WORDS 64
+
+// Length and delimiter positions of a line in the exact format
+// branchExt emits: "0x%08x\t0x%08x\t%d\t%d\t%d\t%d\t%d\n"
+#define CANON_LEN 32
+#define CANON_DELIMS ((1u << 10) | (1u << 21) | (1u << 23) | (1u << 25) | \
+                      (1u << 27) | (1u << 29) | (1u << 31))
+
+//------------------------------------//
+//        Delimiter Scanners          //
+//------------------------------------//
+
+// Each scanner fills, for 'words' 64 byte words starting at 'p', a
+// bitmask of the newlines and a bitmask of all delimiters (tab or newline)
+typedef void (*scan_fn)(const char *p, size_t words, uint64_t *nl, uint64_t *delim);
+
+static void scan_scalar(const char *p, size_t words, uint64_t *nl, uint64_t *delim)
+{
+  for (size_t w = 0; w < words; w++)
+  {
+    uint64_t n = 0;
+    uint64_t d = 0;
+    for (int b = 0; b < 64; b++)
+    {
+      char c = p[w * 64 + b];
+      n |= (uint64_t)(c == '\n') << b;
+      d |= (uint64_t)(c == '\n' || c == '\t') << b;
+    }
+    nl[w] = n;
+    delim[w] = d;
+  }
+}
+
+__attribute__((target("sse4.2")))
+static void scan_sse42(const char *p, size_t words, uint64_t *nl, uint64_t *delim)
+{
+  // PCMPISTRM matches every byte against the whole delimiter set at once
+  const __m128i set = _mm_setr_epi8('\t', '\n', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (size_t w = 0; w < words; w++)
+  {
+    uint64_t n = 0;
+    uint64_t d = 0;
+    for (int k = 0; k < 4; k++)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *)(p + w * 64 + k * 16));
+      __m128i any = _mm_cmpistrm(set, v, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+      n |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)) << (k * 16);
+      d |= (uint64_t)((uint32_t)_mm_cvtsi128_si32(any) & 0xffff) << (k * 16);
+    }
+    nl[w] = n;
+    delim[w] = d;
+  }
+}
+
+__attribute__((target("avx2")))
+static void scan_avx2(const char *p, size_t words, uint64_t *nl, uint64_t *delim)
+{
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  for (size_t w = 0; w < words; w++)
+  {
+    __m256i lo = _mm256_loadu_si256((const __m256i *)(p + w * 64));
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(p + w * 64 + 32));
+    uint64_t n = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, newline)) |
+                 ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, newline)) << 32);
+    uint64_t t = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, tab)) |
+                 ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, tab)) << 32);
+    nl[w] = n;
+    delim[w] = n | t;
+  }
+}
+
+static scan_fn pick_scanner()
+{
+  int avx2 = __builtin_cpu_supports("avx2");
+  int sse42 = __builtin_cpu_supports("sse4.2");
+
+  switch (textParser)
+  {
+  case TEXT_PARSER_AVX2:
+    return avx2 ? scan_avx2 : scan_scalar;
+  case TEXT_PARSER_SSE42:
+    return sse42 ? scan_sse42 : scan_scalar;
+  case TEXT_PARSER_SCALAR:
+    return scan_scalar;
+  default:
+    break;
+  }
+  return avx2 ? scan_avx2 : sse42 ? scan_sse42 : scan_scalar;
+}
+
+// Returns the 32 delimiter bits starting at byte 'off' of the region
+static inline uint32_t delim_bits(const uint64_t *delim, size_t off)
+{
+  size_t w = off >> 6;
+  size_t sh = off & 63;
+  uint64_t v = delim[w] >> sh;
+  if (sh > 32)
+  {
+    v |= delim[w + 1] << (64 - sh);
+  }
+  return (uint32_t)v;
+}
+
+//------------------------------------//
+//           Field Decoders           //
+//------------------------------------//
+
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+// Decodes exactly 8 hex digits, most significant first
+//
+// Returns False if any of them is not a hex digit
+//
+static inline int hex8(const char *s, uint32_t *out)
+{
+  uint64_t v;
+  memcpy(&v, s, 8);
+  if (v & HIGHS)
+  {
+    return 0;
+  }
+
+  // fold 'A'-'F' onto 'a'-'f' for the letter check
+  uint64_t x = v | (0x20 * ONES);
+
+  // per byte range checks, valid since no byte has its top bit set
+  uint64_t digit = (v + (0x80 - '0') * ONES) & ~(v + (0x7f - '9') * ONES) & HIGHS;
+  uint64_t alpha = (x + (0x80 - 'a') * ONES) & ~(x + (0x7f - 'f') * ONES) & HIGHS;
+  if ((digit | alpha) != HIGHS)
+  {
+    return 0;
+  }
+
+  // nibble values, then pack pairs, quads and the whole word. The
+  // first digit sits in the lowest byte
+  x = (x & (0x0f * ONES)) + (alpha >> 7) * 9;
+  x = ((x & 0x000f000f000f000fULL) << 4) | ((x & 0x0f000f000f000f00ULL) >> 8);
+  x = ((x & 0x000000ff000000ffULL) << 8) | ((x & 0x00ff000000ff0000ULL) >> 16);
+  x = ((x & 0x000000000000ffffULL) << 16) | ((x & 0x0000ffff00000000ULL) >> 32);
+  *out = (uint32_t)x;
+  return 1;
+}
+
+// Parses a line in the canonical layout, whose delimiters have already
+// been checked
+//
+// Returns False if a field is malformed
+//
+static inline int parse_canonical(const char *s, branch_record *rec)
+{
+  if (s[0] != '0' || s[1] != 'x' || s[11] != '0' || s[12] != 'x')
+  {
+    return 0;
+  }
+
+  uint32_t pc, target;
+  if (!hex8(s + 2, &pc) || !hex8(s + 13, &target))
+  {
+    return 0;
+  }
+
+  unsigned outcome = (unsigned char)(s[22] - '0');
+  unsigned condition = (unsigned char)(s[24] - '0');
+  unsigned call = (unsigned char)(s[26] - '0');
+  unsigned ret = (unsigned char)(s[28] - '0');
+  unsigned direct = (unsigned char)(s[30] - '0');
+  if (outcome > 9 || condition > 9 || call > 9 || ret > 9 || direct > 9)
+  {
+    return 0;
+  }
+
+  rec->pc = pc;
+  rec->target = target;
+  rec->flags = (outcome ? TRACE_OUTCOME : 0) |
+               (condition ? TRACE_CONDITION : 0) |
+               (call ? TRACE_CALL : 0) |
+               (ret ? TRACE_RET : 0) |
+               (direct ? TRACE_DIRECT : 0);
+  return 1;
+}
+
+// Parses "0x<hex>\t0x<hex>\t<dec>\t<dec>\t<dec>\t<dec>\t<dec>" with any
+// field widths sscanf would read the same way
+//
+// Returns False if the line needs sscanf
+//
+static int parse_strict(const char *s, size_t len, branch_record *rec)
+{
+  const char *e = s + len;
+  uint32_t v[7];
+
+  for (int f = 0; f < 7; f++)
+  {
+    int hex = f < 2;
+    if (hex)
+    {
+      if (e - s < 2 || s[0] != '0' || s[1] != 'x')
+      {
+        return 0;
+      }
+      s += 2;
+    }
+
+    uint32_t val = 0;
+    int digits = 0;
+    for (; s < e && *s != '\t'; s++, digits++)
+    {
+      unsigned c = (unsigned char)*s;
+      unsigned d = c - '0';
+      if (hex && d > 9)
+      {
+        d = (c | 0x20) - 'a' + 10;
+        if (d < 10 || d > 15)
+        {
+          return 0;
+        }
+      }
+      else if (d > 9)
+      {
+        return 0;
+      }
+      val = hex ? (val << 4) | d : val * 10 + d;
+    }
+    if (digits == 0 || digits > (hex ? 8 : 9))
+    {
+      return 0;
+    }
+    v[f] = val;
+
+    // a tab between fields, nothing after the last one
+    if (f < 6)
+    {
+      if (s == e)
+      {
+        return 0;
+      }
+      s++;
+    }
+    else if (s != e)
+    {
+      return 0;
+    }
+  }
+
+  rec->pc = v[0];
+  rec->target = v[1];
+  rec->flags = (v[2] ? TRACE_OUTCOME : 0) |
+               (v[3] ? TRACE_CONDITION : 0) |
+               (v[4] ? TRACE_CALL : 0) |
+               (v[5] ? TRACE_RET : 0) |
+               (v[6] ? TRACE_DIRECT : 0);
+  return 1;
+}
+
+//------------------------------------//
+//           Line Parsers             //
+//------------------------------------//
+
+void parse_text_line_sscanf(const char *line, size_t len, const branch_record *prev, branch_record *rec)
+{
+  // sscanf needs a NUL terminated copy; a well-formed line is ~32 bytes
+  char buf[128];
+  len = std::min(len, sizeof(buf) - 1);
+  memcpy(buf, line, len);
+  buf[len] = '\0';
+
+  uint32_t f[7] = {prev->pc, prev->target,
+                   (prev->flags & TRACE_OUTCOME) ? 1u : 0u,
+                   (prev->flags & TRACE_CONDITION) ? 1u : 0u,
+                   (prev->flags & TRACE_CALL) ? 1u : 0u,
+                   (prev->flags & TRACE_RET) ? 1u : 0u,
+                   (prev->flags & TRACE_DIRECT) ? 1u : 0u};
+  sscanf(buf, "0x%x\t0x%x\t%u\t%u\t%u\t%u\t%u\n",
+         &f[0], &f[1], &f[2], &f[3], &f[4], &f[5], &f[6]);
+
+  rec->pc = f[0];
+  rec->target = f[1];
+  rec->flags = (f[2] ? TRACE_OUTCOME : 0) |
+               (f[3] ? TRACE_CONDITION : 0) |
+               (f[4] ? TRACE_CALL : 0) |
+               (f[5] ? TRACE_RET : 0) |
+               (f[6] ? TRACE_DIRECT : 0);
+}
+
+void parse_text_line(const char *line, size_t len, const branch_record *prev, branch_record *rec)
+{
+  if (textParser == TEXT_PARSER_SSCANF || !parse_strict(line, len, rec))
+  {
+    parse_text_line_sscanf(line, len, prev, rec);
+  }
+}
+
+size_t parse_text_lines(const char **pp, const char *end, branch_record *recs, size_t max, branch_record *prev)
+{
+  static scan_fn scan = pick_scanner();
+  const char *p = *pp;
+  const branch_record *last = prev;
+  size_t n = 0;
+
+  // delimiter masks of one region, plus a zero word for delim_bits()
+  uint64_t nl[SCAN_WORDS + 1];
+  uint64_t delim[SCAN_WORDS + 1];
+
+  while (n < max && textParser != TEXT_PARSER_SSCANF)
+  {
+    size_t words = std::min<size_t>((end - p) / 64, SCAN_WORDS);
+    if (words == 0)
+    {
+      break;
+    }
+    scan(p, words, nl, delim);
+    nl[words] = 0;
+    delim[words] = 0;
+
+    // walk the newlines of the region, one line per set bit
+    size_t off = 0;
+    size_t w = 0;
+    uint64_t m = nl[0];
+    while (n < max)
+    {
+      while (m == 0 && ++w < words)
+      {
+        m = nl[w];
+      }
+      if (m == 0)
+      {
+        break;
+      }
+      size_t pos = w * 64 + __builtin_ctzll(m);
+      m &= m - 1;
+
+      const char *line = p + off;
+      size_t len = pos - off;
+      if (len != CANON_LEN - 1 || delim_bits(delim, off) != CANON_DELIMS ||
+          !parse_canonical(line, &recs[n]))
+      {
+        parse_text_line(line, len, last, &recs[n]);
+      }
+      last = &recs[n++];
+      off = pos + 1;
+    }
+
+    p += off;
+    if (off == 0)
+    {
+      // a line longer than a whole region
+      const char *nlp = (const char *)memchr(p, '\n', end - p);
+      if (nlp == NULL)
+      {
+        break;
+      }
+      parse_text_line(p, nlp - p, last, &recs[n]);
+      last = &recs[n++];
+      p = nlp + 1;
+    }
+  }
+
+  // the last few bytes of the block, and pathological lines
+  while (n < max)
+  {
+    const char *nlp = (const char *)memchr(p, '\n', end - p);
+    if (nlp == NULL)
+    {
+      break;
+    }
+    parse_text_line(p, nlp - p, last, &recs[n]);
+    last = &recs[n++];
+    p = nlp + 1;
+  }
+
+  if (n > 0)
+  {
+    *prev = recs[n - 1];
+  }
+  *pp = p;
+  return n;
+}
+
+int parse_text_parser(const char *name)
+{
+  for (int i = 0; i < 5; i++)
+  {
+    if (!strcmp(name, textParserName[i]))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
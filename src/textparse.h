@@ -0,0 +1,51 @@
+//========================================================//
+//  textparse.h                                           //
+//  Header file for the text trace parser                 //
+//                                                        //
+//  Finds line and field delimiters with SIMD compares    //
+//  and decodes the hex fields without sscanf             //
+//========================================================//
+
+#ifndef TEXTPARSE_H
+#define TEXTPARSE_H
+
+#include <stddef.h>
+#include "trace.h"
+
+// The Different Text Parsers
+#define TEXT_PARSER_AUTO   0 // best SIMD level the CPU supports
+#define TEXT_PARSER_AVX2   1
+#define TEXT_PARSER_SSE42  2
+#define TEXT_PARSER_SCALAR 3 // same parser, delimiters found a byte at a time
+#define TEXT_PARSER_SSCANF 4 // the original line at a time sscanf
+extern const char *textParserName[];
+
+// Parser used by text trace readers
+extern int textParser;
+
+// Parses a --text-parser value
+//
+// Returns the TEXT_PARSER_* constant, -1 if the name is unknown
+//
+int parse_text_parser(const char *name);
+
+// Parses one line (without its newline) with sscanf. Fields that fail
+// to parse keep their value from 'prev', like the original getline +
+// sscanf loop did
+//
+void parse_text_line_sscanf(const char *line, size_t len, const branch_record *prev, branch_record *rec);
+
+// Parses one line (without its newline), falling back to sscanf when
+// the line is not in the exact format branchExt emits
+//
+void parse_text_line(const char *line, size_t len, const branch_record *prev, branch_record *rec);
+
+// Parses the complete lines in [*p, end), at most 'max' of them, and
+// advances *p past the last line parsed. 'prev' is the record before
+// the first line and is updated to the last record parsed
+//
+// Returns the number of records parsed
+//
+size_t parse_text_lines(const char **p, const char *end, branch_record *recs, size_t max, branch_record *prev);
+
+#endif
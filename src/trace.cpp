@@ -0,0 +1,994 @@
+//========================================================//
+//  trace.cpp                                             //
+//  Source file for the branch trace readers              //
+//                                                        //
+//  Byte sources hand out large blocks of raw trace       //
+//  bytes, trace readers decode them into records         //
+//========================================================//
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <immintrin.h>
+#include "trace.h"
+#include "decomp.h"
+#include "textparse.h"
+#include "compact.h"
+
+// Handy Global for use in output routines
+const char *traceFormatName[4] = {"auto", "text", "bin", "compact"};
+
+int playlistCache = 1024;
+
+//------------------------------------//
+//            Byte Sources            //
+//------------------------------------//
+
+FileSource::FileSource(FILE *stream, size_t block_size, int owned)
+  : stream(stream), owned(owned), buf(block_size)
+{
+  // /proc/sys/fs/pipe-max-size may cap this for unprivileged users, in
+  // which case the pipe keeps its size
+  struct stat st;
+  if (fstat(fileno(stream), &st) == 0 && S_ISFIFO(st.st_mode))
+  {
+    fcntl(fileno(stream), F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+  }
+}
+
+FileSource::~FileSource()
+{
+  if (owned)
+  {
+    fclose(stream);
+  }
+}
+
+int FileSource::next(const char **data, size_t *len)
+{
+  size_t n = fread(buf.data(), 1, buf.size(), stream);
+  if (n == 0)
+  {
+    return 0;
+  }
+
+  *data = buf.data();
+  *len = n;
+  return 1;
+}
+
+const char *map_file(int fd, size_t size)
+{
+  if (size == 0)
+  {
+    return NULL;
+  }
+
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    perror("mmap");
+    return NULL;
+  }
+
+  // traces are walked front to back exactly once
+  madvise(map, size, MADV_SEQUENTIAL);
+  posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+  return (const char *)map;
+}
+
+MmapSource::MmapSource(const char *base, size_t size, size_t window)
+  : base(base), size(size), pos(0), window(window)
+{
+  madvise((void *)base, std::min(size, 2 * window), MADV_WILLNEED);
+}
+
+MmapSource::~MmapSource()
+{
+  munmap((void *)base, size);
+}
+
+int MmapSource::next(const char **data, size_t *len)
+{
+  if (pos >= size)
+  {
+    return 0;
+  }
+
+  *data = base + pos;
+  *len = std::min(window, size - pos);
+  pos += *len;
+
+  // keep the page cache one window ahead of the decoder. The mapping is
+  // page aligned and so is every window boundary
+  if (pos + window < size)
+  {
+    madvise((void *)(base + pos + window), std::min(window, size - pos - window), MADV_WILLNEED);
+  }
+  return 1;
+}
+
+ByteSource *open_source(const char *path, int use_mmap)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    perror(path);
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+  {
+    char magic[4];
+    size_t len = pread(fd, magic, sizeof(magic), 0);
+    int format = compressed_format(magic, len);
+
+    if (format != COMPRESS_NONE || use_mmap)
+    {
+      const char *base = map_file(fd, st.st_size);
+      if (base != NULL)
+      {
+        close(fd);
+        if (format != COMPRESS_NONE)
+        {
+          return open_compressed(path, format, base, st.st_size);
+        }
+        return new MmapSource(base, st.st_size);
+      }
+    }
+  }
+
+  // pipes, devices, empty files and --no-mmap go through stdio
+  FILE *stream = fdopen(fd, "r");
+  if (stream == NULL)
+  {
+    perror(path);
+    close(fd);
+    return NULL;
+  }
+  return new FileSource(stream, 1 << 20, 1);
+}
+
+//------------------------------------//
+//           Branch Columns           //
+//------------------------------------//
+
+void branch_columns::assign(const branch_record *recs, size_t n)
+{
+  resize(n);
+  fill(0, recs, n);
+}
+
+void branch_columns::append(const branch_record *recs, size_t n)
+{
+  size_t base = pc.size();
+  resize(base + n);
+  fill(base, recs, n);
+}
+
+void branch_columns::resize(size_t n)
+{
+  pc.resize(n);
+  target.resize(n);
+  outcome.resize(n);
+  flags.resize(n);
+}
+
+// Splits records into columns 8 at a time, gathering each field of the
+// 12 byte records into a vector
+__attribute__((target("avx2")))
+static size_t fill_avx2(const branch_record *recs, size_t n, uint32_t *pc, uint32_t *target,
+                        uint8_t *outcome, uint8_t *flags)
+{
+  const __m256i fields = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+  const __m256i low_bytes = _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                             0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+  {
+    const int *base = (const int *)(recs + i);
+    __m256i p = _mm256_i32gather_epi32(base, fields, 4);
+    __m256i t = _mm256_i32gather_epi32(base + 1, fields, 4);
+    __m256i f = _mm256_shuffle_epi8(_mm256_i32gather_epi32(base + 2, fields, 4), low_bytes);
+    _mm256_storeu_si256((__m256i *)(pc + i), p);
+    _mm256_storeu_si256((__m256i *)(target + i), t);
+    uint64_t bits = (uint32_t)_mm256_extract_epi32(f, 0) | (uint64_t)(uint32_t)_mm256_extract_epi32(f, 4) << 32;
+    memcpy(flags + i, &bits, 8);
+    bits &= 0x0101010101010101ull * TRACE_OUTCOME;
+    memcpy(outcome + i, &bits, 8);
+  }
+  return i;
+}
+
+void branch_columns::fill(size_t base, const branch_record *recs, size_t n)
+{
+  static const int avx2 = __builtin_cpu_supports("avx2");
+  uint32_t *pc_out = pc.data() + base;
+  uint32_t *target_out = target.data() + base;
+  uint8_t *outcome_out = outcome.data() + base;
+  uint8_t *flags_out = flags.data() + base;
+  size_t i = avx2 ? fill_avx2(recs, n, pc_out, target_out, outcome_out, flags_out) : 0;
+  for (; i < n; i++)
+  {
+    pc_out[i] = recs[i].pc;
+    target_out[i] = recs[i].target;
+    outcome_out[i] = recs[i].flags & TRACE_OUTCOME;
+    flags_out[i] = recs[i].flags;
+  }
+}
+
+branch_batch branch_columns::view(size_t first, size_t n) const
+{
+  branch_batch batch;
+  batch.n = n;
+  batch.pc = pc.data() + first;
+  batch.target = target.data() + first;
+  batch.outcome = outcome.data() + first;
+  batch.flags = flags.data() + first;
+  return batch;
+}
+
+//------------------------------------//
+//            Trace Readers           //
+//------------------------------------//
+
+size_t TraceReader::next_batch(const branch_record **recs)
+{
+  batch.resize(TRACE_BATCH);
+  *recs = batch.data();
+  return read(batch.data(), TRACE_BATCH);
+}
+
+TraceDecoder::TraceDecoder(ByteSource *src, const char *data, size_t len)
+  : src(src), cur(data), end(data + len)
+{
+}
+
+TraceDecoder::~TraceDecoder()
+{
+  delete src;
+}
+
+int TraceDecoder::refill()
+{
+  carry.insert(carry.end(), cur, end);
+
+  const char *data;
+  size_t len;
+  if (!src->next(&data, &len))
+  {
+    cur = end;
+    return 0;
+  }
+
+  cur = data;
+  end = data + len;
+  return 1;
+}
+
+//##################
+// text traces
+//##################
+
+TextTraceReader::TextTraceReader(ByteSource *src, const char *data, size_t len)
+  : TraceDecoder(src, data, len)
+{
+  memset(&prev, 0, sizeof(prev));
+}
+
+size_t TextTraceReader::read(branch_record *recs, size_t max)
+{
+  size_t n = 0;
+  while (n < max)
+  {
+    // a line split over two blocks
+    if (!carry.empty())
+    {
+      const char *nl = (const char *)memchr(cur, '\n', end - cur);
+      if (nl == NULL)
+      {
+        if (!refill())
+        {
+          // last line of the trace without a trailing newline
+          parse_text_line(carry.data(), carry.size(), &prev, &recs[n]);
+          prev = recs[n++];
+          carry.clear();
+          break;
+        }
+        continue;
+      }
+      carry.insert(carry.end(), cur, nl);
+      parse_text_line(carry.data(), carry.size(), &prev, &recs[n]);
+      prev = recs[n++];
+      carry.clear();
+      cur = nl + 1;
+      continue;
+    }
+
+    // every complete line of the block
+    n += parse_text_lines(&cur, end, recs + n, max - n, &prev);
+    if (n < max && !refill())
+    {
+      if (!carry.empty())
+      {
+        parse_text_line(carry.data(), carry.size(), &prev, &recs[n]);
+        prev = recs[n++];
+        carry.clear();
+      }
+      break;
+    }
+  }
+
+  return n;
+}
+
+//##################
+// binary traces
+//##################
+
+BinTraceReader::BinTraceReader(ByteSource *src, const char *data, size_t len)
+  : TraceDecoder(src, data, len)
+{
+}
+
+static inline void decode_bin_record(const char *p, branch_record *rec)
+{
+  memcpy(&rec->pc, p, 4);
+  memcpy(&rec->target, p + 4, 4);
+  rec->flags = (uint8_t)p[8];
+}
+
+size_t BinTraceReader::read(branch_record *recs, size_t max)
+{
+  size_t n = 0;
+  while (n < max)
+  {
+    // finish a record that straddles two blocks
+    if (!carry.empty())
+    {
+      size_t take = std::min<size_t>(BIN_RECORD_SIZE - carry.size(), end - cur);
+      carry.insert(carry.end(), cur, cur + take);
+      cur += take;
+      if (carry.size() < BIN_RECORD_SIZE)
+      {
+        if (!refill())
+        {
+          fprintf(stderr, "Warning: truncated record at the end of the binary trace\n");
+          carry.clear();
+          break;
+        }
+        continue;
+      }
+      decode_bin_record(carry.data(), &recs[n++]);
+      carry.clear();
+      continue;
+    }
+
+    size_t avail = (end - cur) / BIN_RECORD_SIZE;
+    if (avail == 0)
+    {
+      if (!refill())
+      {
+        break;
+      }
+      continue;
+    }
+
+    // decode a whole run of records straight out of the block
+    size_t count = std::min(avail, max - n);
+    for (size_t i = 0; i < count; i++)
+    {
+      decode_bin_record(cur + i * BIN_RECORD_SIZE, &recs[n + i]);
+    }
+    n += count;
+    cur += count * BIN_RECORD_SIZE;
+  }
+
+  return n;
+}
+
+TraceReader *open_trace(ByteSource *src, int format)
+{
+  const char *data = "";
+  size_t len = 0;
+  if (!src->next(&data, &len))
+  {
+    data = "";
+    len = 0;
+  }
+
+  int is_bin = len >= BIN_HEADER_SIZE && !memcmp(data, BIN_TRACE_MAGIC, 4);
+  int is_compact = len >= BIN_HEADER_SIZE && !memcmp(data, COMPACT_TRACE_MAGIC, 4);
+  if (format == TRACE_FMT_AUTO)
+  {
+    format = is_bin ? TRACE_FMT_BIN : is_compact ? TRACE_FMT_COMPACT : TRACE_FMT_TEXT;
+  }
+
+  switch (format)
+  {
+  case TRACE_FMT_TEXT:
+    return new TextTraceReader(src, data, len);
+  case TRACE_FMT_BIN:
+    {
+      bin_trace_header hdr;
+      if (!is_bin)
+      {
+        fprintf(stderr, "Input is not a binary trace\n");
+        break;
+      }
+      memcpy(&hdr, data, sizeof(hdr));
+      if (hdr.version != BIN_TRACE_VERSION)
+      {
+        fprintf(stderr, "Unsupported binary trace version %u\n", hdr.version);
+        break;
+      }
+      return new BinTraceReader(src, data + BIN_HEADER_SIZE, len - BIN_HEADER_SIZE);
+    }
+  case TRACE_FMT_COMPACT:
+    {
+      bin_trace_header hdr;
+      if (!is_compact)
+      {
+        fprintf(stderr, "Input is not a compact trace\n");
+        break;
+      }
+      memcpy(&hdr, data, sizeof(hdr));
+      if (hdr.version != COMPACT_TRACE_VERSION)
+      {
+        fprintf(stderr, "Unsupported compact trace version %u\n", hdr.version);
+        break;
+      }
+      CompactTraceReader *compact = new CompactTraceReader(src, data + BIN_HEADER_SIZE, len - BIN_HEADER_SIZE);
+      if (!compact->load_dictionary())
+      {
+        // the reader owns 'src' now
+        delete compact;
+        return NULL;
+      }
+      return compact;
+    }
+  default:
+    break;
+  }
+
+  delete src;
+  return NULL;
+}
+
+//##################
+// async reader
+//##################
+
+AsyncTraceReader::AsyncTraceReader(TraceReader *inner)
+  : inner(inner), head(0), tail(0), eof(0), stopping(0), holding(0), consumed(0)
+{
+  for (int i = 0; i < ASYNC_SLOTS; i++)
+  {
+    slots[i].recs.resize(ASYNC_BATCH);
+    slots[i].count = 0;
+  }
+  thread = std::thread(&AsyncTraceReader::producer, this);
+}
+
+AsyncTraceReader::~AsyncTraceReader()
+{
+  stopping.store(1);
+  thread.join();
+  delete inner;
+}
+
+void AsyncTraceReader::producer()
+{
+  for (;;)
+  {
+    // wait for the consumer to free a slot
+    size_t t = tail.load(std::memory_order_relaxed);
+    while (t - head.load(std::memory_order_acquire) == ASYNC_SLOTS)
+    {
+      if (stopping.load(std::memory_order_relaxed))
+      {
+        return;
+      }
+      std::this_thread::yield();
+    }
+
+    // fill it completely, unless the trace ends first. Reads go in
+    // TRACE_BATCH pieces so a reader destroyed early does not wait for
+    // a whole slot to be decoded
+    slot &s = slots[t % ASYNC_SLOTS];
+    s.count = 0;
+    size_t n;
+    while (s.count < ASYNC_BATCH &&
+           (n = inner->read(s.recs.data() + s.count,
+                            std::min((size_t)TRACE_BATCH, ASYNC_BATCH - s.count))) > 0)
+    {
+      s.count += n;
+      if (stopping.load(std::memory_order_relaxed))
+      {
+        return;
+      }
+    }
+
+    if (s.count > 0)
+    {
+      tail.store(t + 1, std::memory_order_release);
+    }
+    if (s.count < ASYNC_BATCH)
+    {
+      eof.store(1, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+size_t AsyncTraceReader::next_batch(const branch_record **recs)
+{
+  // hand the previous batch back to the producer
+  if (holding)
+  {
+    head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    holding = 0;
+  }
+
+  size_t h = head.load(std::memory_order_relaxed);
+  while (tail.load(std::memory_order_acquire) == h)
+  {
+    // the producer publishes its last batch before raising eof
+    if (eof.load(std::memory_order_acquire) && tail.load(std::memory_order_acquire) == h)
+    {
+      return 0;
+    }
+    std::this_thread::yield();
+  }
+
+  holding = 1;
+  consumed = slots[h % ASYNC_SLOTS].count;
+  *recs = slots[h % ASYNC_SLOTS].recs.data();
+  return slots[h % ASYNC_SLOTS].count;
+}
+
+size_t AsyncTraceReader::read(branch_record *recs, size_t max)
+{
+  size_t n = 0;
+  while (n < max)
+  {
+    if (!holding || consumed == slots[head.load(std::memory_order_relaxed) % ASYNC_SLOTS].count)
+    {
+      const branch_record *batch;
+      if (next_batch(&batch) == 0)
+      {
+        break;
+      }
+      consumed = 0;
+    }
+
+    const slot &s = slots[head.load(std::memory_order_relaxed) % ASYNC_SLOTS];
+    size_t count = std::min(max - n, s.count - consumed);
+    memcpy(recs + n, s.recs.data() + consumed, count * sizeof(branch_record));
+    consumed += count;
+    n += count;
+  }
+  return n;
+}
+
+//##################
+// trace ranges
+//##################
+
+RangeTraceReader::RangeTraceReader(TraceReader *inner, uint64_t first, uint64_t count, uint64_t *history)
+  : inner(inner), batch(NULL), batch_len(0), left(count ? count : UINT64_MAX)
+{
+  memset(history, 0, HISTORY_SNAPSHOT_WORDS * sizeof(uint64_t));
+  while (first > 0)
+  {
+    size_t n = inner->next_batch(&batch);
+    if (n == 0)
+    {
+      break;
+    }
+
+    size_t skip = std::min<uint64_t>(first, n);
+    for (size_t i = 0; i < skip; i++)
+    {
+      if (batch[i].flags & TRACE_CONDITION)
+      {
+        push_history(history, batch[i].flags & TRACE_OUTCOME);
+      }
+    }
+    first -= skip;
+    batch += skip;
+    batch_len = n - skip;
+  }
+}
+
+RangeTraceReader::~RangeTraceReader()
+{
+  delete inner;
+}
+
+size_t RangeTraceReader::read(branch_record *recs, size_t max)
+{
+  size_t n = 0;
+  if (batch_len > 0)
+  {
+    n = std::min<uint64_t>(std::min(max, batch_len), left);
+    memcpy(recs, batch, n * sizeof(branch_record));
+    batch += n;
+    batch_len -= n;
+  }
+  else if (left > 0)
+  {
+    n = inner->read(recs, std::min<uint64_t>(max, left));
+  }
+  left -= n;
+  return n;
+}
+
+size_t RangeTraceReader::next_batch(const branch_record **recs)
+{
+  size_t n = 0;
+  if (batch_len > 0)
+  {
+    *recs = batch;
+    n = batch_len;
+    batch_len = 0;
+  }
+  else if (left > 0)
+  {
+    n = inner->next_batch(recs);
+  }
+  n = std::min<uint64_t>(n, left);
+  left -= n;
+  return n;
+}
+
+//##################
+// playlists
+//##################
+
+static int is_playlist(const char *path)
+{
+  size_t len = strlen(path);
+  size_t suffix = strlen(PLAYLIST_SUFFIX);
+  return len > suffix && !strcmp(path + len - suffix, PLAYLIST_SUFFIX);
+}
+
+int load_playlist(const char *path, std::vector<std::string> &traces, int depth)
+{
+  if (depth > 16)
+  {
+    fprintf(stderr, "%s: playlists nested too deep\n", path);
+    return 0;
+  }
+
+  FILE *stream = fopen(path, "r");
+  if (stream == NULL)
+  {
+    perror(path);
+    return 0;
+  }
+
+  // entries are relative to the directory of the playlist
+  std::string dir(path);
+  size_t slash = dir.rfind('/');
+  dir.resize(slash == std::string::npos ? 0 : slash + 1);
+
+  char line[4096];
+  char name[4096];
+  char count[4096];
+  int lineno = 0;
+  int ok = 1;
+  while (ok && fgets(line, sizeof(line), stream) != NULL)
+  {
+    lineno++;
+    char *comment = strchr(line, '#');
+    if (comment != NULL)
+    {
+      *comment = '\0';
+    }
+
+    long repeat = 1;
+    char extra;
+    char *end = NULL;
+    int fields = sscanf(line, "%4095s %4095s %c", name, count, &extra);
+    if (fields <= 0)
+    {
+      continue;
+    }
+    if (fields == 2)
+    {
+      repeat = strtol(count, &end, 10);
+    }
+    if (fields > 2 || (end != NULL && (end == count || *end != '\0')) || repeat < 0)
+    {
+      fprintf(stderr, "%s:%d: expected <trace> [<repeat count>]\n", path, lineno);
+      ok = 0;
+      break;
+    }
+
+    std::string trace = (name[0] == '/') ? std::string(name) : dir + name;
+    std::vector<std::string> entry;
+    if (is_playlist(trace.c_str()))
+    {
+      ok = load_playlist(trace.c_str(), entry, depth + 1);
+    }
+    else if (access(trace.c_str(), R_OK) != 0)
+    {
+      fprintf(stderr, "%s:%d: ", path, lineno);
+      perror(trace.c_str());
+      ok = 0;
+    }
+    else
+    {
+      entry.push_back(trace);
+    }
+
+    for (long r = 0; ok && r < repeat; r++)
+    {
+      traces.insert(traces.end(), entry.begin(), entry.end());
+    }
+  }
+
+  fclose(stream);
+  return ok;
+}
+
+PlaylistTraceReader::PlaylistTraceReader(const std::vector<std::string> &traces, int format, int use_mmap)
+  : traces(traces), next(0), format(format), use_mmap(use_mmap), current(NULL), playing(NULL),
+    filling(0), replay(NULL), replay_len(0), left(NULL), left_len(0), cached_bytes(0)
+{
+  for (size_t i = 0; i < traces.size(); i++)
+  {
+    cache[traces[i]].plays++;
+  }
+}
+
+PlaylistTraceReader::~PlaylistTraceReader()
+{
+  delete current;
+}
+
+int PlaylistTraceReader::open_next()
+{
+  if (next == traces.size())
+  {
+    return 0;
+  }
+
+  const std::string &path = traces[next++];
+  playing = &cache[path];
+  if (playing->complete)
+  {
+    replay = playing->recs.data();
+    replay_len = playing->recs.size();
+    return 1;
+  }
+
+  uint64_t history[HISTORY_SNAPSHOT_WORDS];
+  current = open_trace_range(path.c_str(), format, use_mmap, 0, 0, history);
+  if (current == NULL)
+  {
+    fprintf(stderr, "Error: cannot play %s\n", path.c_str());
+    exit(1);
+  }
+  filling = playing->plays > 1 && !playing->too_large;
+  return 1;
+}
+
+void PlaylistTraceReader::finish()
+{
+  delete current;
+  current = NULL;
+  if (filling)
+  {
+    playing->complete = 1;
+    filling = 0;
+  }
+  if (--playing->plays == 0)
+  {
+    cached_bytes -= playing->recs.size() * sizeof(branch_record);
+    std::vector<branch_record>().swap(playing->recs);
+    playing->complete = 0;
+  }
+  playing = NULL;
+}
+
+size_t PlaylistTraceReader::next_batch(const branch_record **recs)
+{
+  // what read() left of the last batch goes first
+  if (left_len > 0)
+  {
+    size_t n = left_len;
+    *recs = left;
+    left_len = 0;
+    return n;
+  }
+
+  for (;;)
+  {
+    if (replay_len > 0)
+    {
+      size_t n = replay_len;
+      *recs = replay;
+      replay_len = 0;
+      return n;
+    }
+
+    if (current != NULL)
+    {
+      size_t n = current->next_batch(recs);
+      if (n > 0)
+      {
+        if (filling)
+        {
+          // give up on caching a trace that does not fit
+          if (cached_bytes + n * sizeof(branch_record) > ((size_t)playlistCache << 20))
+          {
+            cached_bytes -= playing->recs.size() * sizeof(branch_record);
+            std::vector<branch_record>().swap(playing->recs);
+            playing->too_large = 1;
+            filling = 0;
+          }
+          else
+          {
+            playing->recs.insert(playing->recs.end(), *recs, *recs + n);
+            cached_bytes += n * sizeof(branch_record);
+          }
+        }
+        return n;
+      }
+    }
+
+    // the last batch of a trace is released on the following call
+    if (playing != NULL)
+    {
+      finish();
+    }
+    if (!open_next())
+    {
+      return 0;
+    }
+  }
+}
+
+size_t PlaylistTraceReader::read(branch_record *recs, size_t max)
+{
+  size_t n = 0;
+  while (n < max)
+  {
+    if (left_len == 0 && (left_len = next_batch(&left)) == 0)
+    {
+      break;
+    }
+    size_t count = std::min(max - n, left_len);
+    memcpy(recs + n, left, count * sizeof(branch_record));
+    left += count;
+    left_len -= count;
+    n += count;
+  }
+  return n;
+}
+
+TraceReader *open_trace_range(const char *path, int format, int use_mmap,
+                              uint64_t first, uint64_t count, uint64_t *history)
+{
+  if (path != NULL && is_playlist(path))
+  {
+    std::vector<std::string> traces;
+    if (!load_playlist(path, traces))
+    {
+      return NULL;
+    }
+    return new RangeTraceReader(new PlaylistTraceReader(traces, format, use_mmap), first, count, history);
+  }
+
+  if (path != NULL && (format == TRACE_FMT_AUTO || format == TRACE_FMT_COMPACT))
+  {
+    TraceReader *reader = open_indexed_trace(path, first, count, history);
+    if (reader != NULL)
+    {
+      return reader;
+    }
+  }
+
+  ByteSource *src = (path != NULL) ? open_source(path, use_mmap) : new FileSource(stdin);
+  if (src == NULL)
+  {
+    return NULL;
+  }
+  TraceReader *reader = open_trace(src, format);
+  if (reader == NULL)
+  {
+    return NULL;
+  }
+  return new RangeTraceReader(reader, first, count, history);
+}
+
+int parse_trace_format(const char *name)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    if (!strcmp(name, traceFormatName[i]))
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+//------------------------------------//
+//            Trace Writers           //
+//------------------------------------//
+
+BinTraceWriter::BinTraceWriter(FILE *stream)
+  : stream(stream), records(0), failed(0)
+{
+  bin_trace_header hdr;
+  memcpy(hdr.magic, BIN_TRACE_MAGIC, 4);
+  hdr.version = BIN_TRACE_VERSION;
+  hdr.records = 0;
+  put(&hdr, sizeof(hdr));
+}
+
+void BinTraceWriter::put(const void *data, size_t len)
+{
+  if (fwrite(data, 1, len, stream) != len)
+  {
+    failed = 1;
+  }
+}
+
+void BinTraceWriter::write(const branch_record *recs, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    uint8_t rec[BIN_RECORD_SIZE];
+    memcpy(rec, &recs[i].pc, 4);
+    memcpy(rec + 4, &recs[i].target, 4);
+    rec[8] = recs[i].flags;
+    buf.insert(buf.end(), rec, rec + BIN_RECORD_SIZE);
+  }
+  records += n;
+
+  if (buf.size() >= (1 << 20))
+  {
+    put(buf.data(), buf.size());
+    buf.clear();
+  }
+}
+
+int BinTraceWriter::close()
+{
+  put(buf.data(), buf.size());
+  buf.clear();
+
+  // patch the record count into the header if we can seek back to it
+  if (fseek(stream, 0, SEEK_SET) == 0)
+  {
+    bin_trace_header hdr;
+    memcpy(hdr.magic, BIN_TRACE_MAGIC, 4);
+    hdr.version = BIN_TRACE_VERSION;
+    hdr.records = records;
+    put(&hdr, sizeof(hdr));
+    fseek(stream, 0, SEEK_END);
+  }
+  if (fflush(stream) != 0 || ferror(stream))
+  {
+    failed = 1;
+  }
+  return !failed;
+}
+
+void write_text_record(FILE *stream, const branch_record *rec)
+{
+  fprintf(stream, "0x%x\t0x%x\t%d\t%d\t%d\t%d\t%d\n", rec->pc, rec->target,
+          (rec->flags & TRACE_OUTCOME) ? 1 : 0,
+          (rec->flags & TRACE_CONDITION) ? 1 : 0,
+          (rec->flags & TRACE_CALL) ? 1 : 0,
+          (rec->flags & TRACE_RET) ? 1 : 0,
+          (rec->flags & TRACE_DIRECT) ? 1 : 0);
+}
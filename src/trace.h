@@ -0,0 +1,432 @@
+//========================================================//
+//  trace.h                                               //
+//  Header file for the branch trace readers              //
+//                                                        //
+//  Decodes text and binary branch traces into blocks     //
+//  of fixed-width branch records                         //
+//========================================================//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+#include <string>
+#include <map>
+#include <atomic>
+#include <thread>
+
+//------------------------------------//
+//        Branch Record Defines       //
+//------------------------------------//
+
+// Bits of the branch record flag byte
+#define TRACE_OUTCOME   0x01 // branch was taken
+#define TRACE_CONDITION 0x02 // conditional branch
+#define TRACE_CALL      0x04 // call instruction
+#define TRACE_RET       0x08 // return instruction
+#define TRACE_DIRECT    0x10 // direct branch
+
+// The Different Trace Formats
+#define TRACE_FMT_AUTO 0 // sniff the format from the first bytes
+#define TRACE_FMT_TEXT 1 // tab separated hex, as emitted by branchExt
+#define TRACE_FMT_BIN  2 // fixed-width binary records
+#define TRACE_FMT_COMPACT 3 // columnar, delta coded (see compact.h)
+extern const char *traceFormatName[];
+
+// Binary trace layout: a 16 byte header followed by packed 9 byte
+// records (32-bit PC, 32-bit target, flag byte), all little endian
+#define BIN_TRACE_MAGIC "BRTR"
+#define BIN_TRACE_VERSION 1
+#define BIN_HEADER_SIZE 16
+#define BIN_RECORD_SIZE 9
+
+// Number of records decoded per call into a trace reader
+#define TRACE_BATCH 4096
+
+// Global history handed to a predictor that starts mid-trace: the
+// outcomes of the last 64 * HISTORY_SNAPSHOT_WORDS conditional branches,
+// the most recent in bit 0 of word 0
+#define HISTORY_SNAPSHOT_WORDS 16
+
+// A single decoded branch
+struct branch_record
+{
+  uint32_t pc;
+  uint32_t target;
+  uint8_t flags;
+};
+
+// A block of branch records as a structure of arrays, the form the
+// predictors simulate in bulk. 'outcome' repeats the TRACE_OUTCOME bit
+// of 'flags' as 0 or 1
+struct branch_batch
+{
+  size_t n;
+  const uint32_t *pc;
+  const uint32_t *target;
+  const uint8_t *outcome;
+  const uint8_t *flags;
+};
+
+// Storage for the columns of a branch_batch
+class branch_columns
+{
+public:
+  // Replaces the columns with 'n' records, or adds them to the end
+  void assign(const branch_record *recs, size_t n);
+  void append(const branch_record *recs, size_t n);
+
+  // Returns records [first, first + n) as a batch
+  branch_batch view(size_t first, size_t n) const;
+
+  size_t size() const { return pc.size(); }
+
+private:
+  void resize(size_t n);
+  void fill(size_t base, const branch_record *recs, size_t n);
+
+  std::vector<uint32_t> pc;
+  std::vector<uint32_t> target;
+  std::vector<uint8_t> outcome;
+  std::vector<uint8_t> flags;
+};
+
+// Header of a binary trace. 'records' is 0 when the writer could not
+// seek back to fill it in (e.g. when writing to a pipe)
+struct bin_trace_header
+{
+  char magic[4];
+  uint32_t version;
+  uint64_t records;
+};
+
+//------------------------------------//
+//            Byte Sources            //
+//------------------------------------//
+
+// A source of raw (uncompressed) trace bytes, handed out one block at
+// a time
+class ByteSource
+{
+public:
+  virtual ~ByteSource() {}
+
+  // Makes the next block of bytes available in [*data, *data + *len).
+  // The block stays valid until the following call
+  //
+  // Returns False at the end of the input
+  //
+  virtual int next(const char **data, size_t *len) = 0;
+};
+
+// Reads a stdio stream in large blocks. The stream is closed with the
+// source only when 'owned' is set
+//
+// Pipes are grown to PIPE_BUFFER_SIZE so a decompressor writing into
+// them is not throttled to the default 64 KiB of buffering
+#define PIPE_BUFFER_SIZE (1 << 20)
+
+class FileSource : public ByteSource
+{
+public:
+  FileSource(FILE *stream, size_t block_size = 1 << 20, int owned = 0);
+  ~FileSource();
+  int next(const char **data, size_t *len);
+
+private:
+  FILE *stream;
+  int owned;
+  std::vector<char> buf;
+};
+
+// Maps a regular file and hands out windows of the mapping in place,
+// with no copy through stdio. The kernel is told the access pattern is
+// sequential and asked to read ahead of the window being decoded
+class MmapSource : public ByteSource
+{
+public:
+  // Takes over a mapping made by map_file()
+  MmapSource(const char *base, size_t size, size_t window = 8 << 20);
+  ~MmapSource();
+  int next(const char **data, size_t *len);
+
+private:
+  const char *base;
+  size_t size;
+  size_t pos;
+  size_t window;
+};
+
+// Maps 'size' bytes of 'fd' read-only
+//
+// Returns NULL if the file cannot be mapped
+//
+const char *map_file(int fd, size_t size);
+
+// Opens 'path' as a byte source. Compressed (.bz2, .zst) files are
+// decompressed on worker threads; other regular files are mapped when
+// 'use_mmap' is set, and everything else is read through stdio
+//
+// Returns NULL if the file cannot be opened
+//
+ByteSource *open_source(const char *path, int use_mmap);
+
+//------------------------------------//
+//            Trace Readers           //
+//------------------------------------//
+
+// A stream of decoded branch records
+class TraceReader
+{
+public:
+  virtual ~TraceReader() {}
+
+  // Decodes up to 'max' records into 'recs'
+  //
+  // Returns the number of records decoded, 0 at the end of the trace
+  //
+  virtual size_t read(branch_record *recs, size_t max) = 0;
+
+  // Hands out the next batch of records in place. The batch stays
+  // valid until the following call
+  //
+  // Returns the number of records in the batch, 0 at the end of the trace
+  //
+  virtual size_t next_batch(const branch_record **recs);
+
+private:
+  std::vector<branch_record> batch;
+};
+
+// Decodes branch records from a byte source. The decoder owns 'src'
+// and deletes it when it is destroyed
+class TraceDecoder : public TraceReader
+{
+public:
+  // 'data' and 'len' describe the first block, already pulled from
+  // 'src' to sniff the trace format
+  TraceDecoder(ByteSource *src, const char *data, size_t len);
+  ~TraceDecoder();
+
+protected:
+  // Refills [cur, end) with the next block, appending any unconsumed
+  // bytes of the current block to 'carry' first
+  //
+  // Returns False at the end of the input
+  //
+  int refill();
+
+  ByteSource *src;
+  const char *cur;
+  const char *end;
+  std::vector<char> carry;
+};
+
+// Tab separated text traces, one branch per line, parsed by the
+// parser textParser selects (see textparse.h)
+class TextTraceReader : public TraceDecoder
+{
+public:
+  TextTraceReader(ByteSource *src, const char *data, size_t len);
+  size_t read(branch_record *recs, size_t max);
+
+private:
+  // the previous record, whose fields a malformed line inherits
+  branch_record prev;
+};
+
+// Fixed-width binary traces
+class BinTraceReader : public TraceDecoder
+{
+public:
+  BinTraceReader(ByteSource *src, const char *data, size_t len);
+  size_t read(branch_record *recs, size_t max);
+};
+
+// Opens a trace reader over 'src'. With TRACE_FMT_AUTO the format is
+// picked from the first bytes of the input
+//
+// Returns NULL if the input does not match the requested format
+//
+TraceReader *open_trace(ByteSource *src, int format);
+
+// Decodes another reader on a thread of its own. Full batches of
+// ASYNC_BATCH records are passed to the consumer through a lock-free
+// single producer, single consumer ring of ASYNC_SLOTS batches, so
+// I/O and decoding overlap the simulation
+#define ASYNC_SLOTS 4
+#define ASYNC_BATCH 65536
+
+class AsyncTraceReader : public TraceReader
+{
+public:
+  // Takes ownership of 'inner' and starts decoding it right away
+  AsyncTraceReader(TraceReader *inner);
+  ~AsyncTraceReader();
+  size_t read(branch_record *recs, size_t max);
+  size_t next_batch(const branch_record **recs);
+
+private:
+  void producer();
+
+  struct slot
+  {
+    std::vector<branch_record> recs;
+    size_t count;
+  };
+
+  TraceReader *inner;
+  slot slots[ASYNC_SLOTS];
+  std::atomic<size_t> head; // next slot the consumer reads
+  std::atomic<size_t> tail; // next slot the producer fills
+  std::atomic<int> eof;
+  std::atomic<int> stopping;
+  int holding;      // the consumer still holds slot 'head'
+  size_t consumed;  // records of slot 'head' handed out by read()
+  std::thread thread;
+};
+
+// Passes on records [first, first + count) of another reader, decoding
+// and dropping the ones before 'first' when it is constructed. A count
+// of 0 runs to the end of the trace
+class RangeTraceReader : public TraceReader
+{
+public:
+  // Takes ownership of 'inner'. 'history' receives the history snapshot
+  // at 'first'
+  RangeTraceReader(TraceReader *inner, uint64_t first, uint64_t count, uint64_t *history);
+  ~RangeTraceReader();
+  size_t read(branch_record *recs, size_t max);
+  size_t next_batch(const branch_record **recs);
+
+private:
+  TraceReader *inner;
+  const branch_record *batch; // records decoded while skipping, not yet passed on
+  size_t batch_len;
+  uint64_t left;
+};
+
+// Plays the traces of a playlist back to back, as if they had been
+// concatenated. A trace that plays more than once is decoded once and
+// replayed from memory, as long as the traces cached at a time fit in
+// playlistCache MiB
+class PlaylistTraceReader : public TraceReader
+{
+public:
+  // 'traces' are the paths of the traces, in playing order
+  PlaylistTraceReader(const std::vector<std::string> &traces, int format, int use_mmap);
+  ~PlaylistTraceReader();
+  size_t read(branch_record *recs, size_t max);
+  size_t next_batch(const branch_record **recs);
+
+private:
+  struct cached_trace
+  {
+    std::vector<branch_record> recs;
+    size_t plays;  // plays left, including the current one
+    int complete;  // 'recs' holds the whole trace
+    int too_large; // did not fit --playlist-cache, never cached again
+  };
+
+  // Starts playing the next trace, from the cache when it is there
+  //
+  // Returns False after the last trace
+  //
+  int open_next();
+
+  // Done with the trace playing now, frees its cache once it has no
+  // plays left
+  void finish();
+
+  std::vector<std::string> traces;
+  size_t next;
+  int format;
+  int use_mmap;
+  TraceReader *current;  // decoder of the trace playing, NULL on a replay
+  cached_trace *playing;
+  int filling;           // the decoded records are being cached
+  const branch_record *replay; // cached records not handed out yet
+  size_t replay_len;
+  const branch_record *left;   // records of the last batch read() has not copied
+  size_t left_len;
+  std::map<std::string, cached_trace> cache;
+  size_t cached_bytes;
+};
+
+// Memory for traces a playlist replays, in MiB
+extern int playlistCache;
+
+// Playlists are text files named *.playlist, with one trace per line
+// and an optional repeat count after it ("x264.bz2 5"). Paths are
+// relative to the playlist, '#' starts a comment, and a playlist may
+// name other playlists
+#define PLAYLIST_SUFFIX ".playlist"
+
+// Appends the traces 'path' plays to 'traces', in order, expanding
+// repeats and nested playlists
+//
+// Returns False if the playlist or one of its traces cannot be read
+//
+int load_playlist(const char *path, std::vector<std::string> &traces, int depth = 0);
+
+// Opens records [first, first + count) of the trace at 'path', or of
+// stdin when 'path' is NULL. Compact traces with an index seek straight
+// to 'first' and decode their chunks in parallel; any other trace or
+// playlist is decoded from the start. A count of 0 runs to the end of the trace.
+// 'history' receives the history snapshot at 'first'
+//
+// Returns NULL if the trace cannot be opened
+//
+TraceReader *open_trace_range(const char *path, int format, int use_mmap,
+                              uint64_t first, uint64_t count, uint64_t *history);
+
+// Shifts a conditional branch outcome into a history snapshot
+static inline void push_history(uint64_t *history, int outcome)
+{
+  for (int w = HISTORY_SNAPSHOT_WORDS - 1; w > 0; w--)
+  {
+    history[w] = (history[w] << 1) | (history[w - 1] >> 63);
+  }
+  history[0] = (history[0] << 1) | (outcome & 1);
+}
+
+// Parses a --trace-format value
+//
+// Returns the TRACE_FMT_* constant, -1 if the name is unknown
+//
+int parse_trace_format(const char *name);
+
+//------------------------------------//
+//            Trace Writers           //
+//------------------------------------//
+
+// Writes fixed-width binary traces
+class BinTraceWriter
+{
+public:
+  BinTraceWriter(FILE *stream);
+  void write(const branch_record *recs, size_t n);
+
+  // Flushes buffered records and fills in the record count in the
+  // header when the stream is seekable
+  //
+  // Returns 0 if any write to the stream failed, 1 otherwise
+  //
+  int close();
+
+private:
+  void put(const void *data, size_t len);
+
+  FILE *stream;
+  uint64_t records;
+  int failed;
+  std::vector<uint8_t> buf;
+};
+
+// Writes a record as a line of a text trace
+void write_text_record(FILE *stream, const branch_record *rec);
+
+#endif
@@ -0,0 +1,220 @@
+//========================================================//
+//  tracecvt.cpp                                          //
+//  Converts branch traces between formats                //
+//                                                        //
+//  bunzip2 -kc trace.bz2 | tracecvt > trace.bin          //
+//========================================================//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+#include "decomp.h"
+#include "textparse.h"
+#include "compact.h"
+
+// Print out the Usage information to stderr
+//
+void usage()
+{
+  fprintf(stderr, "Usage: tracecvt <options> [<input> [<output>]]\n");
+  fprintf(stderr, "       bunzip2 -kc trace.bz2 | tracecvt > trace.bin\n");
+  fprintf(stderr, "       tracecvt trace.bz2 trace.bin\n");
+  fprintf(stderr, "       tracecvt --to=compact trace.bz2 trace.ctr\n");
+  fprintf(stderr, " Options:\n");
+  fprintf(stderr, " --help                   Print this message\n");
+  fprintf(stderr, " --to=<format>            Output format (default bin):\n");
+  fprintf(stderr, "    text\n"
+                  "    bin\n"
+                  "    compact\n");
+  fprintf(stderr, " --codec=<codec>          Compact column codec (default best):\n");
+  fprintf(stderr, "    raw\n"
+                  "    deflate\n"
+                  "    bzip2\n"
+                  "    best     (the smaller of deflate and bzip2, per column)\n");
+  fprintf(stderr, " --block=<n>              Records per compact block (default %d)\n", COMPACT_BLOCK_RECORDS);
+  fprintf(stderr, " --trace-format=<format>  Input format (default auto):\n");
+  fprintf(stderr, "    auto\n"
+                  "    text\n"
+                  "    bin\n"
+                  "    compact\n");
+  fprintf(stderr, " --text-parser=<parser>   Text parser (default auto):\n");
+  fprintf(stderr, "    auto\n"
+                  "    avx2\n"
+                  "    sse4.2\n"
+                  "    scalar\n"
+                  "    sscanf\n");
+  fprintf(stderr, " --decomp-threads=<n>     Threads decompressing a .bz2/.zst input\n"
+                  "                          or decoding an indexed compact input\n");
+  fprintf(stderr, " --skip=<n>               Start the output at branch <n>\n");
+  fprintf(stderr, " --count=<n>              Write at most <n> branches\n");
+}
+
+int main(int argc, char *argv[])
+{
+  const char *in_path = NULL;
+  const char *out_path = "stdout";
+  FILE *out = stdout;
+  int in_format = TRACE_FMT_AUTO;
+  int out_format = TRACE_FMT_BIN;
+  int codec = CODEC_BEST;
+  long block = COMPACT_BLOCK_RECORDS;
+  uint64_t skip = 0;
+  uint64_t count = 0;
+  int files = 0;
+
+  // Process cmdline Arguments
+  for (int i = 1; i < argc; ++i)
+  {
+    if (!strcmp(argv[i], "--help"))
+    {
+      usage();
+      exit(0);
+    }
+    else if (!strncmp(argv[i], "--to=", 5))
+    {
+      out_format = parse_trace_format(argv[i] + 5);
+      if (out_format <= TRACE_FMT_AUTO)
+      {
+        fprintf(stderr, "Unrecognized output format %s\n", argv[i] + 5);
+        exit(1);
+      }
+    }
+    else if (!strncmp(argv[i], "--codec=", 8))
+    {
+      codec = parse_codec(argv[i] + 8);
+      if (codec < 0)
+      {
+        fprintf(stderr, "Unrecognized codec %s\n", argv[i] + 8);
+        exit(1);
+      }
+    }
+    else if (!strncmp(argv[i], "--block=", 8))
+    {
+      block = atol(argv[i] + 8);
+      if (block <= 0 || block > (1 << 26))
+      {
+        fprintf(stderr, "Block size must be between 1 and %d records\n", 1 << 26);
+        exit(1);
+      }
+    }
+    else if (!strncmp(argv[i], "--trace-format=", 15))
+    {
+      in_format = parse_trace_format(argv[i] + 15);
+      if (in_format < 0)
+      {
+        fprintf(stderr, "Unrecognized trace format %s\n", argv[i] + 15);
+        exit(1);
+      }
+    }
+    else if (!strncmp(argv[i], "--text-parser=", 14))
+    {
+      textParser = parse_text_parser(argv[i] + 14);
+      if (textParser < 0)
+      {
+        fprintf(stderr, "Unrecognized text parser %s\n", argv[i] + 14);
+        exit(1);
+      }
+    }
+    else if (!strncmp(argv[i], "--decomp-threads=", 17))
+    {
+      decompThreads = atoi(argv[i] + 17);
+    }
+    else if (!strncmp(argv[i], "--skip=", 7))
+    {
+      skip = strtoull(argv[i] + 7, NULL, 0);
+    }
+    else if (!strncmp(argv[i], "--count=", 8))
+    {
+      count = strtoull(argv[i] + 8, NULL, 0);
+    }
+    else if (!strncmp(argv[i], "--", 2))
+    {
+      fprintf(stderr, "Unrecognized option %s\n", argv[i]);
+      usage();
+      exit(1);
+    }
+    else if (files == 0)
+    {
+      in_path = argv[i];
+      files++;
+    }
+    else if (files == 1)
+    {
+      out = fopen(argv[i], "wb");
+      out_path = argv[i];
+      files++;
+      if (out == NULL)
+      {
+        perror(argv[i]);
+        exit(1);
+      }
+    }
+    else
+    {
+      usage();
+      exit(1);
+    }
+  }
+
+  uint64_t history[HISTORY_SNAPSHOT_WORDS];
+  TraceReader *reader = open_trace_range(in_path, in_format, 1, skip, count, history);
+  if (reader == NULL)
+  {
+    exit(1);
+  }
+
+  BinTraceWriter *writer = NULL;
+  CompactTraceWriter *compact = NULL;
+  if (out_format == TRACE_FMT_BIN)
+  {
+    writer = new BinTraceWriter(out);
+  }
+  else if (out_format == TRACE_FMT_COMPACT)
+  {
+    compact = new CompactTraceWriter(out, codec, block);
+  }
+
+  branch_record recs[TRACE_BATCH];
+  size_t n;
+  while ((n = reader->read(recs, TRACE_BATCH)) > 0)
+  {
+    if (writer != NULL)
+    {
+      writer->write(recs, n);
+    }
+    else if (compact != NULL)
+    {
+      compact->write(recs, n);
+    }
+    else
+    {
+      for (size_t i = 0; i < n; i++)
+      {
+        write_text_record(out, &recs[i]);
+      }
+    }
+  }
+
+  // Cleanup
+  int ok = 1;
+  if (writer != NULL)
+  {
+    ok = writer->close();
+    delete writer;
+  }
+  if (compact != NULL)
+  {
+    ok = compact->close();
+    delete compact;
+  }
+  delete reader;
+  ok = (fclose(out) == 0) && ok;
+  if (!ok)
+  {
+    perror(out_path);
+    exit(1);
+  }
+
+  return 0;
+}